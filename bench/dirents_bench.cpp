@@ -0,0 +1,117 @@
+// $Id: dirents_bench.cpp,v 1.1 2026-10-18 06:30:00-07 - - $
+
+// dirents_bench -
+//    Compares the flat dirent_map used by directories against the
+//    std::map it replaced, for the operations behind mkdir and make
+//    (insert), path resolution (lookup), ls (ordered iteration) and
+//    rm (erase).  Usage:  dirents_bench [entries...]
+//    Prints one line per container, operation and size:
+//       container op entries ns_per_op
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "dirents.h"
+
+using bench_clock = chrono::steady_clock;
+
+// std_map -
+//    Adapter giving std::map the dirent_map interface.
+
+class std_map {
+   private:
+      map<string,size_t,less<>> entries;
+   public:
+      size_t lookup (string_view name) const {
+         auto found = entries.find (name);
+         return found == entries.end() ? 0 : found->second;
+      }
+      bool insert (pair<string,size_t> entry) {
+         return entries.insert (move (entry)).second;
+      }
+      bool erase (string_view name) {
+         auto found = entries.find (name);
+         if (found == entries.end()) return false;
+         entries.erase (found);
+         return true;
+      }
+      auto begin() const {return entries.begin();}
+      auto end() const {return entries.end();}
+};
+
+vector<string> make_names (size_t count) {
+   mt19937_64 random {count};
+   vector<string> names;
+   names.reserve (count);
+   for (size_t index = 0; index < count; ++index) {
+      names.push_back ("file" + to_string (random() % 100000000)
+                       + "_" + to_string (index));
+   }
+   return names;
+}
+
+template <typename func_t>
+double time_per_op (size_t ops, func_t func) {
+   auto start = bench_clock::now();
+   func();
+   chrono::duration<double,nano> elapsed = bench_clock::now() - start;
+   return elapsed.count() / ops;
+}
+
+template <typename container_t>
+void run (const string& label, const vector<string>& names) {
+   container_t dirents;
+   size_t count = names.size();
+   size_t sink = 0;
+   auto report = [&] (const char* op, double nanos) {
+      cout << label << " " << op << " " << count << " " << nanos
+           << endl;
+   };
+   report ("insert", time_per_op (count, [&] {
+      for (size_t index = 0; index < count; ++index) {
+         dirents.insert ({names[index], index + 1});
+      }
+   }));
+   report ("lookup", time_per_op (count, [&] {
+      for (size_t index = count; index-- > 0;) {
+         sink += dirents.lookup (names[index]);
+      }
+   }));
+   report ("iterate", time_per_op (count, [&] {
+      for (const auto& entry: dirents) sink += entry.second;
+   }));
+   report ("erase", time_per_op (count, [&] {
+      for (size_t index = 0; index < count; index += 2) {
+         sink += dirents.erase (names[index]);
+      }
+      for (const auto& entry: dirents) sink += entry.second;
+      for (size_t index = 1; index < count; index += 2) {
+         sink += dirents.erase (names[index]);
+      }
+   }));
+   if (sink == 0) cerr << "unexpected empty result" << endl;
+}
+
+int main (int argc, char** argv) {
+   vector<size_t> sizes {1000, 100000, 1000000};
+   if (argc > 1) {
+      sizes.clear();
+      for (int arg = 1; arg < argc; ++arg) {
+         sizes.push_back (strtoul (argv[arg], nullptr, 10));
+      }
+   }
+   for (size_t size: sizes) {
+      vector<string> names = make_names (size);
+      run<std_map> ("std::map", names);
+      run<dirent_map> ("dirent_map", names);
+   }
+   return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,137 @@
+// $Id: dispatch_bench.cpp,v 1.1 2026-10-18 07:50:00-07 - - $
+
+// dispatch_bench -
+//    Times finding the function for each line of a script, with the
+//    compile-time perfect hash behind find_command_fn against the
+//    unordered_map of command names it replaced.  The lookup alone,
+//    and the whole of getting from a line to its function:  splitting
+//    it with split or tokenize and then the lookup.
+//    Usage:  dispatch_bench [lines...]
+//    Prints one line per method, op and size:
+//       method op lines ns_per_line
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#include "commands.h"
+#include "util.h"
+
+using bench_clock = chrono::steady_clock;
+
+// old_hash -
+//    The command table as it was, looked up by string.
+
+const unordered_map<string,command_fn> old_hash {
+   {"cat"   , fn_cat    },
+   {"cd"    , fn_cd     },
+   {"cp"    , fn_cp     },
+   {"echo"  , fn_echo   },
+   {"exit"  , fn_exit   },
+   {"load"  , fn_load   },
+   {"ls"    , fn_ls     },
+   {"lsr"   , fn_lsr    },
+   {"make"  , fn_make   },
+   {"mkdir" , fn_mkdir  },
+   {"prompt", fn_prompt },
+   {"pwd"   , fn_pwd    },
+   {"rm"    , fn_rm     },
+   {"rmr"   , fn_rmr    },
+   {"save"  , fn_save   },
+   {"#"     , fn_nothing},
+};
+
+// make_script -
+//    Lines weighted the way generated fixture scripts are:  mostly
+//    make and mkdir, some cat, ls and rm.
+
+vector<string> make_script (size_t count) {
+   static const vector<string> lines {
+      "make d1/d2/file42 the quick brown fox",
+      "make d1/d2/file43 jumps over the lazy dog",
+      "make d1/file7 some words",
+      "mkdir d1/d2/d3",
+      "cat d1/d2/file42",
+      "ls d1/d2",
+      "rm d1/file7",
+      "cd d1",
+      "# a comment",
+   };
+   mt19937_64 random {count};
+   vector<string> script;
+   script.reserve (count);
+   for (size_t index = 0; index < count; ++index) {
+      script.push_back (lines[random() % lines.size()]);
+   }
+   return script;
+}
+
+template <typename func_t>
+double time_per_op (size_t ops, func_t func) {
+   auto start = bench_clock::now();
+   func();
+   chrono::duration<double,nano> elapsed = bench_clock::now() - start;
+   return elapsed.count() / ops;
+}
+
+void run (const vector<string>& script) {
+   size_t count = script.size();
+   size_t sink = 0;
+   auto report = [&] (const char* method, const char* op,
+                      double nanos) {
+      cout << method << " " << op << " " << count << " " << nanos
+           << endl;
+   };
+   auto note = [&] (command_fn fn) {
+      sink += reinterpret_cast<uintptr_t> (fn) & 1;
+      ++sink;
+   };
+   vector<wordvec> split_lines;
+   vector<wordviews> viewed_lines (count);
+   for (size_t index = 0; index < count; ++index) {
+      split_lines.push_back (split (script[index], " \t"));
+      tokenize (script[index], " \t", viewed_lines[index]);
+   }
+   report ("unordered_map", "lookup", time_per_op (count, [&] {
+      for (const auto& words: split_lines) {
+         note (old_hash.find (words[0])->second);
+      }
+   }));
+   report ("perfect_hash", "lookup", time_per_op (count, [&] {
+      for (const auto& words: viewed_lines) {
+         note (find_command_fn (words[0]));
+      }
+   }));
+   report ("unordered_map", "line", time_per_op (count, [&] {
+      for (const auto& line: script) {
+         wordvec words = split (line, " \t");
+         note (old_hash.find (words[0])->second);
+      }
+   }));
+   report ("perfect_hash", "line", time_per_op (count, [&] {
+      wordviews words;
+      for (const auto& line: script) {
+         tokenize (line, " \t", words);
+         note (find_command_fn (words[0]));
+      }
+   }));
+   if (sink == 0) cerr << "unexpected empty result" << endl;
+}
+
+int main (int argc, char** argv) {
+   vector<size_t> sizes {1000, 1000000};
+   if (argc > 1) {
+      sizes.clear();
+      for (int arg = 1; arg < argc; ++arg) {
+         sizes.push_back (strtoul (argv[arg], nullptr, 10));
+      }
+   }
+   for (size_t size: sizes) run (make_script (size));
+   return EXIT_SUCCESS;
+}
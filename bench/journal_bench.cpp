@@ -0,0 +1,146 @@
+// $Id: journal_bench.cpp,v 1.1 2026-10-18 12:00:00-07 - - $
+
+// journal_bench -
+//    Measures what keeping a journal costs commands, and how fast a
+//    journal brings a tree back.  A script making directories full of
+//    files, entering them, and removing or writing over some files is
+//    run through the command functions as yshell runs them, first
+//    alone and then keeping a journal, committed at the end.  Then the
+//    journal is opened on a new filesystem, replaying it as yshell -j
+//    does at startup, which should take less time than running the
+//    script again would.
+//    Usage:  journal_bench [-s scale] [-d dir]
+//    The journal is written in dir, by default /tmp, and removed at
+//    the end.  Prints one line per phase, with fields separated by
+//    spaces:
+//       phase lines seconds lines_per_second journal_bytes
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "file_sys.h"
+#include "journal.h"
+#include "util.h"
+
+using bench_clock = chrono::steady_clock;
+
+// null_buffer -
+//    A streambuf which drops what is written to it, a buffer at a
+//    time, so output costs what formatting it costs.
+
+class null_buffer: public streambuf {
+   private:
+      char buffer[4096];
+   public:
+      null_buffer() {setp (buffer, buffer + sizeof buffer);}
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         setp (buffer, buffer + sizeof buffer);
+         return traits_type::not_eof (ch);
+      }
+};
+
+static vector<string> make_script (size_t scale) {
+   mt19937_64 random {scale};
+   vector<string> lines;
+   for (size_t dir = 0; dir < 100 * scale; ++dir) {
+      string name = "/d" + to_string (dir);
+      lines.push_back ("mkdir " + name);
+      lines.push_back ("cd " + name);
+      for (size_t file = 0; file < 500; ++file) {
+         lines.push_back ("make f" + to_string (file) + " a few words "
+                          + to_string (random() % 1000));
+      }
+      for (size_t step = 0; step < 100; ++step) {
+         string path = "f" + to_string (random() % 500);
+         lines.push_back (random() % 2 == 0 ? "rm " + path
+                                            : "make " + path + " over");
+      }
+   }
+   return lines;
+}
+
+static void run_script (inode_state& state, const vector<string>& lines) {
+   wordviews words;
+   for (const auto& line: lines) {
+      tokenize (line, " \t", words);
+      try {
+         find_command_fn (words.at (0)) (state, words);
+      }catch (command_error&) {
+         // As for a file removed twice.
+      }
+   }
+}
+
+static void report (const string& phase, size_t lines,
+                    bench_clock::duration elapsed, const string& path) {
+   double seconds = chrono::duration<double> (elapsed).count();
+   struct stat status {};
+   stat (path.c_str(), &status);
+   cout << phase << " " << lines << " " << seconds << " "
+        << lines / seconds << " " << status.st_size << endl;
+}
+
+int main (int argc, char** argv) {
+   size_t scale = 1;
+   string dir = "/tmp";
+   int option;
+   while ((option = getopt (argc, argv, "d:s:")) != EOF) {
+      switch (option) {
+         case 'd': dir = optarg; break;
+         case 's': scale = strtoul (optarg, nullptr, 10); break;
+         default:
+            cerr << "Usage: " << argv[0] << " [-s scale] [-d dir]"
+                 << endl;
+            return EXIT_FAILURE;
+      }
+   }
+   string path = dir + "/journal_bench." + to_string (getpid());
+   vector<string> lines = make_script (scale);
+   null_buffer sink;
+   streambuf* out = cout.rdbuf (&sink);
+   bench_clock::duration alone, journaled, replayed;
+   try {
+      {
+         inode_state state;
+         auto start = bench_clock::now();
+         run_script (state, lines);
+         alone = bench_clock::now() - start;
+      }
+      {
+         inode_state state;
+         journal log (state, path);
+         auto start = bench_clock::now();
+         run_script (state, lines);
+         log.commit();
+         journaled = bench_clock::now() - start;
+      }
+      {
+         inode_state state;
+         auto start = bench_clock::now();
+         journal log (state, path);
+         replayed = bench_clock::now() - start;
+      }
+   }catch (journal_error& error) {
+      cout.rdbuf (out);
+      cerr << error.what() << endl;
+      unlink (path.c_str());
+      return EXIT_FAILURE;
+   }
+   cout.rdbuf (out);
+   report ("script", lines.size(), alone, path);
+   report ("journaled", lines.size(), journaled, path);
+   report ("replay", lines.size(), replayed, path);
+   unlink (path.c_str());
+   return EXIT_SUCCESS;
+}
+
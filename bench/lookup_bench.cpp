@@ -0,0 +1,206 @@
+// $Id: lookup_bench.cpp,v 1.1 2026-10-18 11:00:00-07 - - $
+
+// lookup_bench -
+//    Measures how path lookups scale with threads while sessions
+//    share a tree, as under yshell -u.  A tree of directories width
+//    wide and depth deep is built, then for each thread count, that
+//    many readers resolve random paths down to its leaves through
+//    directory::lookup, pinned as an epoch reader for each path,
+//    while one writer makes and removes directories all through the
+//    tree, as mkdir and rm do beside them, publishing new versions
+//    and retiring the old.  Each count runs twice:  epoch, with
+//    readers taking no locks, and rwlock, with each lookup holding a
+//    shared lock on its directory, and the writer an exclusive one.
+//    Usage:  lookup_bench [-d depth] [-w width] [-s seconds]
+//                         [threads...]
+//    Prints one line per mode and thread count, with fields
+//    separated by spaces:
+//       mode threads lookups seconds lookups_per_second writes
+//       retired_pending
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+
+#include "epoch.h"
+#include "file_sys.h"
+
+using bench_clock = chrono::steady_clock;
+
+struct options {
+   size_t depth {4};
+   size_t width {16};
+   double seconds {1.0};
+   vector<size_t> threads {1, 2, 4, 8};
+};
+
+// tree -
+//    The filesystem, the paths of its leaves, the directories above
+//    them, which the writer changes, and a lock per inode for the
+//    rwlock mode.
+
+struct tree {
+   file_system fs;
+   vector<vector<string>> leaves;
+   vector<size_t> parents;
+   vector<shared_mutex> locks;
+   explicit tree (const options& opts);
+};
+
+tree::tree (const options& opts) {
+   inode_table& table = fs.getTable();
+   vector<pair<inode_ptr,vector<string>>> level {{fs.getRoot(), {}}};
+   for (size_t height = 0; height < opts.depth; ++height) {
+      vector<pair<inode_ptr,vector<string>>> below;
+      for (auto& [node, path]: level) {
+         directory& dir = table.dir (*node);
+         if (height + 1 == opts.depth) {
+            parents.push_back (node->get_inode_nr());
+         }
+         for (size_t index = 0; index < opts.width; ++index) {
+            string name = "d" + to_string (index);
+            vector<string> longer = path;
+            longer.push_back (name);
+            below.push_back ({dir.mkdir (name), move (longer)});
+         }
+      }
+      level = move (below);
+   }
+   for (auto& entry: level) leaves.push_back (move (entry.second));
+   // Readers lock only the directories built here, never those the
+   // writer makes.
+   locks = vector<shared_mutex> (table.next_inode_nr());
+}
+
+// resolve -
+//    Walks a path from the root, returning the number of lookups.
+
+template <bool locked>
+size_t resolve (tree& shared, const vector<string>& path) {
+   inode_table& table = shared.fs.getTable();
+   inode_ptr node = shared.fs.getRoot();
+   size_t lookups = 0;
+   for (const string& name: path) {
+      directory& dir = table.dir (*node);
+      size_t nr;
+      ++lookups;
+      if constexpr (locked) {
+         shared_lock<shared_mutex> held (
+               shared.locks[node->get_inode_nr()]);
+         nr = dir.lookup (name);
+      }else {
+         nr = dir.lookup (name);
+      }
+      if (nr == 0) break;
+      node = &table[nr];
+   }
+   return lookups;
+}
+
+// churn -
+//    Makes and removes a directory below a random parent of leaves
+//    until stopped, returning the number of changes.
+
+template <bool locked>
+size_t churn (tree& shared, atomic<bool>& stop) {
+   inode_table& table = shared.fs.getTable();
+   mt19937_64 random {7};
+   size_t writes = 0;
+   while (not stop.load (memory_order_relaxed)) {
+      size_t nr = shared.parents[random() % shared.parents.size()];
+      directory& dir = table.dir (table[nr]);
+      {
+         auto writing = dir.writing();
+         unique_lock<shared_mutex> held;
+         if constexpr (locked) {
+            held = unique_lock<shared_mutex> (shared.locks[nr]);
+         }
+         if (dir.lookup ("churn") == 0) dir.mkdir ("churn");
+                                   else dir.remove ("churn");
+      }
+      shared.fs.epochs().collect();
+      ++writes;
+   }
+   return writes;
+}
+
+template <bool locked>
+void run (const char* mode, tree& shared, size_t threads,
+          double seconds) {
+   atomic<bool> stop {false};
+   vector<size_t> counts (threads);
+   vector<thread> readers;
+   auto start = bench_clock::now();
+   for (size_t index = 0; index < threads; ++index) {
+      readers.emplace_back ([&, index] {
+         mt19937_64 random {index + 1};
+         size_t lookups = 0;
+         while (not stop.load (memory_order_relaxed)) {
+            const auto& path = shared.leaves[random()
+                                             % shared.leaves.size()];
+            epoch_domain::reader reading;
+            lookups += resolve<locked> (shared, path);
+         }
+         counts[index] = lookups;
+      });
+   }
+   size_t writes = 0;
+   thread writer ([&] {writes = churn<locked> (shared, stop);});
+   this_thread::sleep_for (chrono::duration<double> (seconds));
+   stop = true;
+   for (auto& reader: readers) reader.join();
+   writer.join();
+   chrono::duration<double> elapsed = bench_clock::now() - start;
+   size_t lookups = 0;
+   for (size_t count: counts) lookups += count;
+   cout << mode << " " << threads << " " << lookups << " "
+        << elapsed.count() << " " << lookups / elapsed.count() << " "
+        << writes << " " << shared.fs.epochs().pending() << endl;
+}
+
+int main (int argc, char** argv) {
+   options opts;
+   for (;;) {
+      int option = getopt (argc, argv, "d:s:w:");
+      if (option == EOF) break;
+      switch (option) {
+         case 'd': opts.depth = strtoul (optarg, nullptr, 10); break;
+         case 's': opts.seconds = strtod (optarg, nullptr); break;
+         case 'w': opts.width = strtoul (optarg, nullptr, 10); break;
+         default:
+            cerr << "Usage: " << argv[0]
+                 << " [-d depth] [-w width] [-s seconds] [threads...]"
+                 << endl;
+            return EXIT_FAILURE;
+      }
+   }
+   if (optind < argc) {
+      opts.threads.clear();
+      for (int arg = optind; arg < argc; ++arg) {
+         opts.threads.push_back (strtoul (argv[arg], nullptr, 10));
+      }
+   }
+   if (opts.depth == 0 or opts.width == 0) {
+      cerr << argv[0] << ": depth and width must be positive" << endl;
+      return EXIT_FAILURE;
+   }
+   tree shared (opts);
+   // As while a server runs, with the tree lock held shared.
+   shared.fs.set_concurrent (true);
+   for (size_t threads: opts.threads) {
+      run<false> ("epoch", shared, threads, opts.seconds);
+      run<true> ("rwlock", shared, threads, opts.seconds);
+   }
+   shared.fs.set_concurrent (false);
+   return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,298 @@
+// $Id: yshell_bench.cpp,v 1.1 2026-10-18 08:00:00-07 - - $
+
+// yshell_bench -
+//    Runs generated workloads through the same command functions as
+//    yshell and measures them.  Each workload runs in its own child
+//    process, so its peak RSS is its own.  Output of the commands is
+//    formatted and dropped, so only the shell itself is timed.
+//    Usage:  yshell_bench [-s scale] [workload...]
+//    The scale multiplies the size of every workload.  Workloads:
+//       wide   files made in one directory, then listed
+//       deep   a chain of directories entered one by one, then removed
+//       large  files of many words, made and then read back
+//       mixed  random mkdir, make, cat and rm over a tree
+//       lsr    a tree of a million nodes at scale 1, listed once
+//       dup    directories of files sharing a few contents, copied
+//              whole, then partly written over
+//       grep   a tree of files of random words searched for a rare
+//              word, a common one, one missing, and a substring
+//    Prints one line per workload and command, plus one for all of
+//    the commands of the workload, with fields separated by spaces:
+//       workload command count seconds per_second p50_ns p99_ns
+//       max_rss_kb
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "file_sys.h"
+#include "util.h"
+
+using bench_clock = chrono::steady_clock;
+
+// null_buffer -
+//    A streambuf which drops what is written to it, a buffer at a
+//    time, so output costs what formatting it costs.
+
+class null_buffer: public streambuf {
+   private:
+      char buffer[4096];
+   public:
+      null_buffer() {setp (buffer, buffer + sizeof buffer);}
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         setp (buffer, buffer + sizeof buffer);
+         return traits_type::not_eof (ch);
+      }
+};
+
+// runner -
+//    Runs command lines against one filesystem, recording how long
+//    each took under the name of its command.
+
+class runner {
+   private:
+      inode_state state;
+      wordviews words;
+      map<string,vector<uint64_t>> latencies;
+   public:
+      void operator() (const string& line) {
+         tokenize (line, " \t", words);
+         auto start = bench_clock::now();
+         try {
+            find_command_fn (words.at (0)) (state, words);
+         }catch (command_error&) {
+            // As for a missing file, which mixed runs into.
+         }
+         auto elapsed = bench_clock::now() - start;
+         latencies[string (words[0])].push_back (
+               chrono::duration_cast<chrono::nanoseconds>
+                     (elapsed).count());
+      }
+      void report (const string& workload);
+};
+
+// percentile -
+//    Returns the given percentile of the latencies, reordering them.
+
+static uint64_t percentile (vector<uint64_t>& times, size_t percent) {
+   if (times.empty()) return 0;
+   size_t rank = min (times.size() - 1, times.size() * percent / 100);
+   nth_element (times.begin(), times.begin() + rank, times.end());
+   return times[rank];
+}
+
+void runner::report (const string& workload) {
+   struct rusage usage;
+   getrusage (RUSAGE_SELF, &usage);
+   auto line = [&] (const string& command, vector<uint64_t>& times) {
+      uint64_t total = 0;
+      for (auto nanos: times) total += nanos;
+      double seconds = total / 1e9;
+      cout << workload << " " << command << " " << times.size()
+           << " " << seconds << " "
+           << (seconds > 0 ? times.size() / seconds : 0) << " "
+           << percentile (times, 50) << " " << percentile (times, 99)
+           << " " << usage.ru_maxrss << endl;
+   };
+   vector<uint64_t> all;
+   for (auto& [command, times]: latencies) {
+      all.insert (all.end(), times.begin(), times.end());
+      line (command, times);
+   }
+   line ("all", all);
+}
+
+// workloads -
+//    Each generates its lines for the given scale and feeds them to
+//    the runner.
+
+using workload_fn = void (*)(runner& run, size_t scale);
+
+static void wide (runner& run, size_t scale) {
+   run ("mkdir w");
+   for (size_t file = 0; file < 100000 * scale; ++file) {
+      run ("make w/f" + to_string (file) + " some words in a file");
+   }
+   run ("ls w");
+   run ("lsr /");
+}
+
+static void deep (runner& run, size_t scale) {
+   run ("mkdir c");
+   run ("cd c");
+   for (size_t depth = 0; depth < 10000 * scale; ++depth) {
+      run ("mkdir c");
+      run ("cd c");
+   }
+   run ("make f at the bottom");
+   run ("cat f");
+   run ("cd /");
+   run ("rmr c");
+}
+
+static void large (runner& run, size_t scale) {
+   string words;
+   for (size_t word = 0; word < 100000; ++word) {
+      words += " w" + to_string (word);
+   }
+   for (size_t file = 0; file < 100 * scale; ++file) {
+      run ("make f" + to_string (file) + words);
+   }
+   for (size_t file = 0; file < 100 * scale; ++file) {
+      run ("cat f" + to_string (file));
+   }
+}
+
+static void mixed (runner& run, size_t scale) {
+   mt19937_64 random {scale};
+   constexpr size_t DIRS = 100;
+   for (size_t dir = 0; dir < DIRS; ++dir) {
+      run ("mkdir d" + to_string (dir));
+   }
+   for (size_t step = 0; step < 200000 * scale; ++step) {
+      string path = "d" + to_string (random() % DIRS) + "/f"
+                  + to_string (random() % 1000);
+      switch (random() % 10) {
+         case 0: run ("rm " + path); break;
+         case 1: case 2: run ("cat " + path); break;
+         case 3: run ("ls d" + to_string (random() % DIRS)); break;
+         default: run ("make " + path + " a few words"); break;
+      }
+   }
+}
+
+static void lsr (runner& run, size_t scale) {
+   for (size_t dir = 0; dir < 1000 * scale; ++dir) {
+      string name = "d" + to_string (dir);
+      run ("mkdir " + name);
+      run ("cd " + name);
+      for (size_t file = 0; file < 1000; ++file) {
+         run ("make f" + to_string (file) + " x");
+      }
+      run ("cd /");
+   }
+   run ("lsr /");
+}
+
+static void dup (runner& run, size_t scale) {
+   constexpr size_t FIXTURES = 20;
+   vector<string> fixtures;
+   for (size_t fixture = 0; fixture < FIXTURES; ++fixture) {
+      string words;
+      for (size_t word = 0; word < 1000; ++word) {
+         words += " f" + to_string (fixture) + "w" + to_string (word);
+      }
+      fixtures.push_back (words);
+   }
+   for (size_t dir = 0; dir < 20 * scale; ++dir) {
+      string name = "d" + to_string (dir);
+      run ("mkdir " + name);
+      for (size_t file = 0; file < 1000; ++file) {
+         run ("make " + name + "/f" + to_string (file)
+              + fixtures[(dir + file) % FIXTURES]);
+      }
+   }
+   run ("cp -r /d0 /copy");
+   for (size_t file = 0; file < 1000; file += 10) {
+      run ("make copy/f" + to_string (file) + fixtures[file % 7]);
+   }
+   run ("stats");
+}
+
+static void grep (runner& run, size_t scale) {
+   mt19937_64 random {scale};
+   for (size_t dir = 0; dir < 100 * scale; ++dir) {
+      string name = "d" + to_string (dir);
+      run ("mkdir " + name);
+      for (size_t file = 0; file < 1000; ++file) {
+         string line = "make " + name + "/f" + to_string (file);
+         for (size_t word = 0; word < 20; ++word) {
+            line += " w" + to_string (random() % 100000);
+         }
+         if (random() % 10000 == 0) line += " needle";
+         run (line);
+      }
+   }
+   for (size_t query = 0; query < 10; ++query) {
+      run ("grep needle /");
+      run ("grep w" + to_string (random() % 100000) + " /");
+      run ("grep missing /");
+      run ("grep -s eedl /");
+   }
+}
+
+static const map<string,workload_fn> workloads {
+   {"wide" , wide },
+   {"deep" , deep },
+   {"large", large},
+   {"mixed", mixed},
+   {"lsr"  , lsr  },
+   {"dup"  , dup  },
+   {"grep" , grep },
+};
+
+// run_workload -
+//    Runs the workload in a child process and waits for it.
+
+static bool run_workload (const string& name, workload_fn workload,
+                          size_t scale) {
+   cout.flush();
+   pid_t child = fork();
+   if (child < 0) {
+      cerr << "fork failed" << endl;
+      return false;
+   }
+   if (child == 0) {
+      null_buffer sink;
+      runner run;
+      streambuf* out = cout.rdbuf (&sink);
+      workload (run, scale);
+      cout.rdbuf (out);
+      run.report (name);
+      _exit (EXIT_SUCCESS);
+   }
+   int status = 0;
+   waitpid (child, &status, 0);
+   return WIFEXITED (status) and WEXITSTATUS (status) == EXIT_SUCCESS;
+}
+
+int main (int argc, char** argv) {
+   size_t scale = 1;
+   int option;
+   while ((option = getopt (argc, argv, "s:")) != EOF) {
+      if (option == 's') scale = strtoul (optarg, nullptr, 10);
+   }
+   vector<string> names;
+   for (int arg = optind; arg < argc; ++arg) names.push_back (argv[arg]);
+   if (names.empty()) {
+      names = {"wide", "deep", "large", "mixed", "lsr", "dup",
+               "grep"};
+   }
+   int status = EXIT_SUCCESS;
+   for (const auto& name: names) {
+      auto found = workloads.find (name);
+      if (found == workloads.end()) {
+         cerr << name << ": no such workload" << endl;
+         status = EXIT_FAILURE;
+         continue;
+      }
+      if (not run_workload (name, found->second, scale)) {
+         cerr << name << ": failed" << endl;
+         status = EXIT_FAILURE;
+      }
+   }
+   return status;
+}
@@ -1,43 +1,214 @@
 // $Id: commands.cpp,v 1.18 2019-10-08 13:55:31-07 - - $
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+
 #include "util.h"
 #include "commands.h"
 #include "debug.h"
+#include "host.h"
+#include "image.h"
+#include "journal.h"
+#include "stats.h"
 #include "iomanip"
 
-command_hash cmd_hash {
-   {"cat"   , fn_cat    },
-   {"cd"    , fn_cd     },
-   {"echo"  , fn_echo   },
-   {"exit"  , fn_exit   },
-   {"ls"    , fn_ls     },
-   {"lsr"   , fn_lsr    },
-   {"make"  , fn_make   },
-   {"mkdir" , fn_mkdir  },
-   {"prompt", fn_prompt },
-   {"pwd"   , fn_pwd    },
-   {"rm"    , fn_rm     },
-   {"rmr"   , fn_rmr    },
-   {"#"     , fn_nothing},
+// shared_always, shared_never, shared_leaf, shared_unless_copied -
+//    Whether a command may run beside others in sessions of one
+//    filesystem; see runs_shared.  Some commands may only when what
+//    they name is not shared with a copy, for writing it would swap
+//    the contents of its inode under readers, or when it is a plain
+//    file or an empty directory, for removing anything else would
+//    free what other sessions may be working in.  Both are only
+//    looked at holding the tree lock shared, when a copy cannot be
+//    made, but a directory can be filled, so fn_rm looks again.
+
+static bool shared_always (inode_state&, const wordviews&) {
+   return true;
+}
+
+static bool shared_never (inode_state&, const wordviews&) {
+   return false;
+}
+
+static bool shared_leaf (inode_state& state, const wordviews& words) {
+   if(words.size() < 2) return true;
+   try{
+      path_walk walk = resolve_path(state, words[1]);
+      if(walk.node == nullptr) return true;
+      if(walk.leaf.empty() || walk.leaf == "." || walk.leaf == ".."){
+         return false;
+      }
+      auto dir = dynamic_cast<directory*>(walk.node->getContents().get());
+      return dir == nullptr || dir->size() <= 2;
+   }catch(runtime_error&){
+      // Fails the same way when run.
+      return true;
+   }
+}
+
+static bool shared_unless_copied (inode_state& state,
+                                  const wordviews& words) {
+   if(words.size() < 2) return true;
+   try{
+      path_walk walk = resolve_path(state, words[1]);
+      return walk.node == nullptr
+             || walk.node->getContents().use_count() == 1;
+   }catch(runtime_error&){
+      return true;
+   }
+}
+
+// cmd_table -
+//    The built-in commands.  The dispatch table below is generated
+//    from this one at compile time, so a command is added here only.
+//    Each says whether it may run beside others in sessions of one
+//    filesystem.
+
+using shared_fn = bool (*)(inode_state&, const wordviews&);
 
+struct command_entry {
+   string_view name;
+   command_fn fn;
+   shared_fn shared;
+};
 
+static constexpr command_entry cmd_table[] {
+   {"cat"       , fn_cat       , shared_always       },
+   {"cd"        , fn_cd        , shared_always       },
+   {"checkpoint", fn_checkpoint, shared_never        },
+   {"cp"        , fn_cp        , shared_never        },
+   {"echo"      , fn_echo      , shared_always       },
+   {"exit"      , fn_exit      , shared_always       },
+   {"export"    , fn_export    , shared_never        },
+   {"grep"      , fn_grep      , shared_never        },
+   {"import"    , fn_import    , shared_never        },
+   {"load"      , fn_load      , shared_never        },
+   {"ls"        , fn_ls        , shared_always       },
+   {"lsr"       , fn_lsr       , shared_never        },
+   {"make"      , fn_make      , shared_unless_copied},
+   {"mkdir"     , fn_mkdir     , shared_always       },
+   {"prompt"    , fn_prompt    , shared_always       },
+   {"pwd"       , fn_pwd       , shared_always       },
+   {"rm"        , fn_rm        , shared_leaf         },
+   {"rmr"       , fn_rmr       , shared_never        },
+   {"save"      , fn_save      , shared_never        },
+   {"stats"     , fn_stats     , shared_never        },
+   {"#"         , fn_nothing   , shared_always       },
 };
 
-inode_ptr findNode( inode_state& state, string path);
-void preExitClear(inode_ptr& node);
-int stringToInt(string str);
+// cmd_hash -
+//    Commands added at run time by register_command.  Only looked in
+//    when a name is not built in.
+
+static command_hash cmd_hash;
+
+// dispatch_hash -
+//    Hashes a command name by its length and its first and last
+//    chars, which is enough to tell the built-in commands apart, so
+//    a name is hashed without reading all of it.  The seed is chosen
+//    at compile time to give each built-in command its own slot.
+
+static constexpr size_t DISPATCH_SLOTS = 128;
+
+static constexpr size_t dispatch_hash (string_view name, size_t seed) {
+   if (name.empty()) return 0;
+   size_t first = static_cast<unsigned char> (name.front());
+   size_t last = static_cast<unsigned char> (name.back());
+   return (name.size() * seed + first * 31 + last) % DISPATCH_SLOTS;
+}
+
+static constexpr bool perfect_seed (size_t seed) {
+   array<bool,DISPATCH_SLOTS> used {};
+   for (const auto& entry: cmd_table) {
+      size_t slot = dispatch_hash (entry.name, seed);
+      if (used[slot]) return false;
+      used[slot] = true;
+   }
+   return true;
+}
 
+static constexpr size_t find_seed() {
+   for (size_t seed = 1; seed < 4 * DISPATCH_SLOTS; ++seed) {
+      if (perfect_seed (seed)) return seed;
+   }
+   return 0;
+}
 
-command_fn find_command_fn (const string& cmd) {
+static constexpr size_t DISPATCH_SEED = find_seed();
+static_assert (DISPATCH_SEED != 0,
+               "no perfect hash for cmd_table, raise DISPATCH_SLOTS");
+
+// dispatch_slots -
+//    For each hash, one more than the index in cmd_table of the
+//    command with that hash, or 0 for none.
+
+static constexpr array<uint8_t,DISPATCH_SLOTS> make_dispatch_slots() {
+   array<uint8_t,DISPATCH_SLOTS> slots {};
+   for (size_t index = 0; index < size (cmd_table); ++index) {
+      slots[dispatch_hash (cmd_table[index].name, DISPATCH_SEED)]
+            = static_cast<uint8_t> (index + 1);
+   }
+   return slots;
+}
+
+static constexpr auto dispatch_slots = make_dispatch_slots();
+
+int stringToInt(string_view str);
+
+// next_component -
+//    Returns the next slash-separated component of a pathname at or
+//    after pos and advances pos past it.  Returns an empty view when
+//    there are no more components.  Nothing is allocated.
+
+static string_view next_component(string_view path, size_t& pos){
+   size_t start = path.find_first_not_of('/', pos);
+   if(start == string_view::npos){
+      pos = path.size();
+      return {};
+   }
+   pos = path.find_first_of('/', start);
+   if(pos == string_view::npos) pos = path.size();
+   return path.substr(start, pos - start);
+}
+
+
+// find_builtin -
+//    Returns the entry in cmd_table for a command, or nullptr.
+
+static const command_entry* find_builtin (string_view cmd) {
+   size_t slot = dispatch_slots[dispatch_hash (cmd, DISPATCH_SEED)];
+   if (slot != 0 and cmd_table[slot - 1].name == cmd) {
+      return &cmd_table[slot - 1];
+   }
+   return nullptr;
+}
+
+command_fn find_command_fn (string_view cmd) {
+   DEBUGF ('c', "[" << cmd << "]");
+   if (const command_entry* builtin = find_builtin (cmd)) {
+      return builtin->fn;
+   }
    // Note: value_type is pair<const key_type, mapped_type>
    // So: iterator->first is key_type (string)
    // So: iterator->second is mapped_type (command_fn)
-   DEBUGF ('c', "[" << cmd << "]");
-   const auto result = cmd_hash.find (cmd);
-   if (result == cmd_hash.end()) {
-      throw command_error (cmd + ": no such function");
+   if (not cmd_hash.empty()) {
+      const auto result = cmd_hash.find (string (cmd));
+      if (result != cmd_hash.end()) return result->second;
    }
-   return result->second;
+   throw command_error (string (cmd) + ": no such function");
+}
+
+bool runs_shared (inode_state& state, const wordviews& words) {
+   const command_entry* builtin = find_builtin (words.at (0));
+   return builtin != nullptr and builtin->shared (state, words);
+}
+
+void register_command (const string& cmd, command_fn fn) {
+   DEBUGF ('c', "[" << cmd << "]");
+   cmd_hash.insert_or_assign (cmd, fn);
 }
 
 command_error::command_error (const string& what):
@@ -50,82 +221,144 @@ int exit_status_message() {
    return status;
 }
 
-void fn_cat (inode_state& state, const wordvec& words){
+void fn_cat (inode_state& state, const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   wordvec filenames;
-   for(long unsigned int i = 1; i < words.size(); i++){
-      filenames.push_back(words[i]);
-   }
-
-
-   inode_ptr targetNode;
-   for(auto filename : filenames){
-      if(filename.find("/") != string::npos){
-         size_t lastSlash = filename.find_last_of("/");
-         string path = filename.substr(0,lastSlash+1);
-         filename = filename.substr(lastSlash+1);
-         targetNode = findNode(state,path);
-      }else{
-         targetNode = state.getCwd();
-      }
-
-      if (targetNode->getContents()->getdirents().count(filename) == 0)
-      {
-         throw command_error (filename + ": no such file");
+   ostream& out = state.out();
+   for(auto name = words.cbegin() + 1; name != words.cend(); ++name){
+      path_walk walk = resolve_path(state, *name);
+      if(walk.node == nullptr){
+         throw command_error (string(walk.leaf) + ": no such file");
       }
-
-      auto fileMapObj = 
-         targetNode->getContents()->getdirents().find(filename);
-      auto filePtr = fileMapObj->second;
-      auto data = filePtr->getContents()->readfile();
- 
-      for(auto word : data){
-         cout << word << " ";
-      }
-      cout << endl;
+      // Stored as printed, so the file goes out in one write.
+      string_view text = walk.node->getContents()->readfile().text();
+      out.write(text.data(), text.size());
+      out << "\n";
    }
 }
 
-void fn_cd (inode_state& state, const wordvec& words){
+void fn_cd (inode_state& state, const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   
-   state.changeCwd(findNode(state,words[1])); 
-   
+   if(words.size() < 2){
+      throw command_error ("cd: usage: cd pathname");
+   }
+
+   path_walk walk = resolve_path(state, words[1]);
+   if(walk.node == nullptr){
+      throw command_error (string(walk.leaf) + ": no such directory");
+   }
+   if(walk.node->getContents()->fileType() != "directory"){
+      throw command_error (string(walk.leaf) + ": not a directory");
+   }
+   state.changeCwd(walk.node);
 
    if(words[1].at(0) == '/'){
       state.getCwdPath().clear();
    }
 
-
-   wordvec parsedPath = split(words[1],"/");
-   for(auto dir : parsedPath){ 
+   size_t pos = 0;
+   for(;;){
+      string_view dir = next_component(words[1], pos);
+      if(dir.empty()) break;
       if(dir == ".."){
-         state.getCwdPath().pop_back();
-      }
-      else if(dir == "."){
-         
+         if(not state.getCwdPath().empty()){
+            state.getCwdPath().pop_back();
+         }
       }
-      else {
-         state.getCwdPath().push_back(dir);  
+      else if(dir != "."){
+         state.getCwdPath().emplace_back(dir);
       }
+   }
+   journal_entry logged(state);
+   logged.cwd();
+}
+
+// checkpoint_journal -
+//    Saves the tree as a checkpoint of the journal, if there is one,
+//    after a command which changes too much of it to record.
 
+static void checkpoint_journal(inode_state& state){
+   journal* log = state.getFileSystem().getJournal();
+   if(log == nullptr) return;
+   try{
+      log->checkpoint(state);
+   }catch(journal_error& error){
+      throw command_error (error.what());
    }
 }
 
-void fn_echo (inode_state& state, const wordvec& words){
+// fn_checkpoint -
+//    checkpoint.  Saves the tree as the next checkpoint of the journal
+//    and starts the journal again after it, as is otherwise done once
+//    the journal has grown past the last checkpoint.
+
+void fn_checkpoint (inode_state& state,
+                    [[maybe_unused]] const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(state.getFileSystem().getJournal() == nullptr){
+      throw command_error ("checkpoint: no journal");
+   }
+   checkpoint_journal(state);
+}
+
+// fn_cp -
+//    cp [-r] source target.  The copy is a clone sharing everything
+//    below it with the source until either is written, so copying a
+//    whole subtree, say to snapshot it, takes constant time.  If the
+//    target is a directory, the copy goes into it under the name of
+//    the source.
+
+void fn_cp (inode_state& state, const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   cout << word_range (words.cbegin() + 1, words.cend()) << endl;
+   bool recursive = words.size() > 1 && words[1] == "-r";
+   size_t first = recursive ? 2 : 1;
+   if(words.size() != first + 2){
+      throw command_error ("cp: usage: cp [-r] source target");
+   }
+   path_walk from = resolve_path(state, words[first]);
+   if(from.node == nullptr){
+      throw command_error (string(from.leaf) + ": no such file");
+   }
+   if(!recursive && from.node->getContents()->fileType() == "directory"){
+      throw command_error (string(from.leaf) + ": is a directory");
+   }
+   path_walk to = resolve_path(state, words[first + 1]);
+   inode_ptr parent = to.parent;
+   string name {to.leaf};
+   if(to.node != nullptr){
+      if(to.node->getContents()->fileType() != "directory"){
+         throw command_error (name + ": file exists");
+      }
+      parent = to.node;
+      name = from.node->getName();
+   }
+   if(name.empty() || name == "." || name == ".."){
+      throw command_error (string(words[first + 1]) + ": invalid target");
+   }
+   directory& target = state.getTable().dir(*parent);
+   if(target.getdirents().count(name) > 0){
+      throw command_error (name + ": file exists");
+   }
+   journal_entry logged(state);
+   target.link(name, state.getTable().clone(*from.node));
+   logged.clone(*from.node, *parent, name);
+}
+
+void fn_echo (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   state.out() << wordview_range (words.cbegin() + 1, words.cend())
+               << "\n";
 }
 
 
-void fn_exit (inode_state& state, const wordvec& words){
+void fn_exit ([[maybe_unused]] inode_state& state,
+              const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   //set all content pointers to null
-   preExitClear(state.getRoot());
    if(words.size() > 1){
       exec::status(stringToInt(words[1]));
    }else{
@@ -134,143 +367,483 @@ void fn_exit (inode_state& state, const wordvec& words){
    throw ysh_exit();
 }
 
-void fn_ls (inode_state& state, const wordvec& words){
+// fn_export -
+//    export target [ypath].  Copies the yshell directory ypath, by
+//    default the cwd, to the host directory target, or with a target
+//    of -, writes it as a ustar archive to the session's archive
+//    stream.  Only yshell -e has one, the standard output it keeps
+//    apart from the transcript, which would corrupt the archive.
+
+void fn_export (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(words.size() != 2 && words.size() != 3){
+      throw command_error ("export: usage: export target [ypath]");
+   }
+   inode_ptr source = state.getCwd();
+   if(words.size() == 3){
+      path_walk walk = resolve_path(state, words[2]);
+      if(walk.node == nullptr){
+         throw command_error (string(walk.leaf) + ": no such directory");
+      }
+      source = walk.node;
+   }
+   if(source->getContents()->fileType() != "directory"){
+      throw command_error (string(words[2]) + ": not a directory");
+   }
+   try{
+      if(words[1] == "-"){
+         ostream* archive = state.archive();
+         if(archive == nullptr){
+            throw command_error ("export: -: standard output holds the "
+                                 "transcript, run yshell -e");
+         }
+         export_tar(state, *source, *archive);
+         archive->flush();
+      }else{
+         export_tree(state, *source, string(words[1]));
+      }
+   }catch(host_error& error){
+      throw command_error ("export: " + string(error.what()));
+   }
+}
+
+// walk_files -
+//    Calls visit with the pathname of each plain file at or below
+//    top, in the order lsr lists them.  Walks with an explicit stack,
+//    like plan_lsr, entering each directory through inode_table::dir,
+//    so the entries of clones are seen as their own.
+
+static void walk_files(inode_table& table, inode& top,
+                       const function<void(const string&,
+                                           plain_file&)>& visit){
+   auto file = dynamic_cast<plain_file*>(top.getContents().get());
+   if(file != nullptr){
+      visit(table.path(top.get_inode_nr()), *file);
+      return;
+   }
+   struct frame {
+      string path;
+      dirent_map::const_iterator next;
+      dirent_map::const_iterator end;
+   };
+   vector<frame> stack;
+   auto enter = [&](inode& node, string path){
+      auto& dirents = table.dir(node).getdirents();
+      stack.push_back({move(path), dirents.begin(), dirents.end()});
+   };
+   enter(top, table.path(top.get_inode_nr()));
+   while(not stack.empty()){
+      frame& top_frame = stack.back();
+      if(top_frame.next == top_frame.end){
+         stack.pop_back();
+         continue;
+      }
+      const auto& entry = *top_frame.next;
+      ++top_frame.next;
+      if(entry.first == "." || entry.first == "..") continue;
+      inode& node = table[entry.second];
+      string path = top_frame.path + "/" + entry.first;
+      file = dynamic_cast<plain_file*>(node.getContents().get());
+      if(file != nullptr) visit(path, *file);
+                     else enter(node, move(path));
+   }
+}
+
+// scan_words -
+//    Returns the positions of the words containing the pattern.  Each
+//    candidate is found by string_view::find, which looks for the
+//    first char of the pattern with memchr, vectorized by the C
+//    library, and the scan goes on from the next word once one
+//    matches.
+
+static vector<uint32_t> scan_words(const file_words& words,
+                                   string_view pattern){
+   vector<uint32_t> positions;
+   string_view text = words.text();
+   const uint32_t* offsets = words.index();
+   const uint32_t* last = offsets + words.size() + 1;
+   size_t from = 0;
+   for(;;){
+      size_t found = text.find(pattern, from);
+      if(found == string_view::npos) break;
+      // The pattern holds no space, so it lies within one word.
+      const uint32_t* word = upper_bound(offsets, last,
+                                         offsets[0] + found) - 1;
+      positions.push_back(word - offsets);
+      from = word[1] - offsets[0];
+   }
+   return positions;
+}
+
+// lsr_order -
+//    Orders pathnames as lsr lists them, a directory's entries right
+//    after it and before any name that follows it, by comparing them
+//    as though the slash came before every other char.
+
+static bool lsr_order(const string& left, const string& right){
+   auto rank = [](char c){
+      return c == '/' ? 0 : static_cast<unsigned char>(c) + 1;
+   };
+   return lexicographical_compare(left.begin(), left.end(),
+                                  right.begin(), right.end(),
+                                  [&](char a, char b){
+                                     return rank(a) < rank(b);
+                                  });
+}
+
+// fn_grep -
+//    grep [-s] word [pathname].  Lists each plain file at or below
+//    the pathname, by default the cwd, holding the word, with the
+//    positions of the word among its words, counting from 1, in the
+//    order lsr lists them.  The word is looked up in the word index,
+//    and each block holding it leads back to the names of the files
+//    holding it, kept if they lie below the pathname, so no file's
+//    words are read and the tree is not walked:  the cost is that of
+//    the matches.  With -s, lists the words containing the pattern
+//    instead, which the index cannot find, by walking the files below
+//    the pathname and scanning each distinct block once.
+
+void fn_grep (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   bool substring = words.size() > 1 && words[1] == "-s";
+   size_t first = substring ? 2 : 1;
+   if(words.size() != first + 1 && words.size() != first + 2){
+      throw command_error ("grep: usage: grep [-s] word [pathname]");
+   }
+   string_view pattern = words[first];
+   if(pattern.empty()){
+      throw command_error ("grep: empty pattern");
+   }
+   inode_ptr top = state.getCwd();
+   if(words.size() == first + 2){
+      path_walk walk = resolve_path(state, words[first + 1]);
+      if(walk.node == nullptr){
+         throw command_error (string(walk.leaf)
+                              + ": no such file or directory");
+      }
+      top = walk.node;
+   }
+   inode_table& table = state.getTable();
+   ostream& out = state.out();
+   auto print = [&](const string& path, const vector<uint32_t>& found){
+      out << (path.empty() ? "/" : path) << ":";
+      for(uint32_t position : found) out << " " << position + 1;
+      out << "\n";
+   };
+   if(substring){
+      // Positions by the slot of a block, as each is first scanned.
+      unordered_map<uint32_t,vector<uint32_t>> positions;
+      walk_files(table, *top, [&](const string& path, plain_file& file){
+         uint32_t slot = file.slot();
+         if(slot == 0) return;
+         auto found = positions.find(slot);
+         if(found == positions.end()){
+            found = positions.emplace(slot, scan_words(file.readfile(),
+                                                       pattern)).first;
+         }
+         if(not found->second.empty()) print(path, found->second);
+      });
+      return;
+   }
+   blob_store& blobs = state.getFileSystem().getBlobs();
+   auto postings = blobs.find_word(pattern);
+   if(postings.empty()) return;
+   // Postings come grouped by block, each block's in order.
+   vector<pair<uint32_t,vector<uint32_t>>> positions;
+   for(const auto& posting : postings){
+      if(positions.empty() || positions.back().first != posting.slot){
+         positions.push_back({posting.slot, {}});
+      }
+      positions.back().second.push_back(posting.position);
+   }
+   string prefix = table.path(top->get_inode_nr());
+   bool is_file = dynamic_cast<plain_file*>(top->getContents().get())
+                  != nullptr;
+   auto below = [&](const string& path){
+      if(is_file) return path == prefix;
+      return path.size() > prefix.size()
+          && path.compare(0, prefix.size(), prefix) == 0
+          && path[prefix.size()] == '/';
+   };
+   vector<pair<string,const vector<uint32_t>*>> matches;
+   vector<string> paths;
+   for(const auto& [slot, found] : positions){
+      for(const plain_file* file : blobs.files(slot)){
+         paths.clear();
+         table.file_paths(*file, paths);
+         for(auto& path : paths){
+            if(below(path)) matches.push_back({move(path), &found});
+         }
+      }
+   }
+   sort(matches.begin(), matches.end(),
+        [](const auto& left, const auto& right){
+           return lsr_order(left.first, right.first);
+        });
+   for(const auto& [path, found] : matches) print(path, *found);
+}
+
+// fn_import -
+//    import hostpath ypath.  Copies a host directory into the yshell
+//    directory ypath, which is made if it does not exist.
+
+void fn_import (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(words.size() != 3){
+      throw command_error ("import: usage: import hostpath ypath");
+   }
+   path_walk walk = resolve_path(state, words[2]);
+   if(walk.node != nullptr
+      && walk.node->getContents()->fileType() != "directory"){
+      throw command_error (string(walk.leaf) + ": not a directory");
+   }
+   //made only once the host directory has been read
+   auto target = [&]() -> inode& {
+      if(walk.node != nullptr) return *walk.node;
+      return *state.getTable().dir(*walk.parent)
+                  .mkdir(string(walk.leaf));
+   };
+   //journaled as a checkpoint, even if it stopped part way
+   try{
+      import_tree(state, string(words[1]), target);
+   }catch(host_error& error){
+      checkpoint_journal(state);
+      throw command_error ("import: " + string(error.what()));
+   }
+   checkpoint_journal(state);
+}
+
+void fn_load (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(words.size() < 2){
+      throw command_error ("load: missing image name");
+   }
+   try{
+      load_image(state, string(words[1]));
+   }catch(image_error& error){
+      throw command_error (error.what());
+   }
+   checkpoint_journal(state);
+}
+
+void fn_ls (inode_state& state, const wordviews& words){
    inode_ptr currentDir;
    if(words.size() > 1){
-      currentDir = findNode(state, words[1]);
+      path_walk walk = resolve_path(state, words[1]);
+      if(walk.node == nullptr){
+         throw command_error (string(walk.leaf) + ": no such directory");
+      }
+      currentDir = walk.node;
    }
    else{
       currentDir = state.getCwd();
    }
+   ostream& out = state.out();
    if(currentDir  == state.getRoot()){
-      cout << "/:" << endl;
+      out << "/:" << "\n";
    }
    else{
-      cout  << currentDir->getPath() <<":"<<endl;
+      out   << state.getTable().path(currentDir->get_inode_nr())
+            <<":"<<"\n";
    }
    
-   for( auto mapObj : currentDir->getContents()->getdirents()){
-      auto inodePtr = mapObj.second;
-      cout << setw(6)<< inodePtr->get_inode_nr() 
+   directory& dir = state.getTable().dir(*currentDir);
+   for( auto mapObj : dir.getdirents().snapshot()){
+      inode_ptr inodePtr = &state.getTable()[mapObj.second];
+      out << setw(6)<< inodePtr->get_inode_nr() 
          << setw(6)
          << inodePtr->getContents()->size() 
          << "  " << mapObj.first;
       if(currentDir->getContents()->fileType() == "directory")  {
-         cout << "/" ;
+         out << "/" ;
       } 
-      cout << endl;
+      out << "\n";
    }
 }
 
-void fn_lsr (inode_state& state, const wordvec& words){
+// lsr_segment -
+//    A run of entries of one directory that lsr prints together, with
+//    the directory's header line first if header is set.  lsr lists a
+//    subdirectory where its entry would be, so a directory with
+//    subdirectories is printed as several segments with the listings
+//    of its subdirectories in between.
+
+struct lsr_segment {
+   inode_ptr dir;
+   bool header;
+   dirent_map::const_iterator from;
+   dirent_map::const_iterator to;
+};
+
+// plan_lsr -
+//    Walks the tree below top by reference, with an explicit stack so
+//    a deep chain does not overflow the real one, and lists the
+//    segments in the order they are printed.  Every directory is
+//    entered through inode_table::dir here, so clones get their own
+//    entries before printing starts and printing changes nothing.
+//    Returns the number of entries listed.
+
+static size_t plan_lsr(inode_table& table, inode_ptr top,
+                       vector<lsr_segment>& plan){
+   struct frame {
+      inode_ptr node;
+      dirent_map::const_iterator next;
+      dirent_map::const_iterator end;
+      bool resumed;
+   };
+   vector<frame> stack;
+   size_t entries = 0;
+   auto enter = [&](inode_ptr node){
+      auto& dirents = table.dir(*node).getdirents();
+      stack.push_back({node, dirents.begin(), dirents.end(), false});
+      plan.push_back({node, true, dirents.begin(), dirents.begin()});
+      entries += dirents.size();
+   };
+   enter(top);
+   while(not stack.empty()){
+      frame& top_frame = stack.back();
+      if(top_frame.resumed){
+         plan.push_back({top_frame.node, false, top_frame.next,
+                         top_frame.next});
+         top_frame.resumed = false;
+      }
+      if(top_frame.next == top_frame.end){
+         stack.pop_back();
+         continue;
+      }
+      const auto& entry = *top_frame.next;
+      ++top_frame.next;
+      inode& node = table[entry.second];
+      if(entry.first == "." || entry.first == ".."
+         || dynamic_cast<directory*>(node.getContents().get()) == nullptr){
+         plan.back().to = top_frame.next;
+         continue;
+      }
+      top_frame.resumed = true;
+      enter(&node);
+   }
+   return entries;
+}
+
+// render_lsr -
+//    Formats one segment into its own buffer, reading the tree only.
+
+static void render_lsr(inode_table& table, const lsr_segment& segment,
+                       string& out){
+   if(segment.header){
+      string path = table.path(segment.dir->get_inode_nr());
+      out += path.empty() ? "/" : path;
+      out += ":\n";
+   }
+   char line[64];
+   for(auto entry = segment.from; entry != segment.to; ++entry){
+      inode& node = table[entry->second];
+      int length = snprintf(line, sizeof line, "%6zu%6zu  ",
+                            node.get_inode_nr(),
+                            node.getContents()->size());
+      out.append(line, length);
+      out += entry->first;
+      if(entry->first == "." || entry->first == ".."){
+         out += '/';
+      }
+      out += '\n';
+   }
+}
+
+// fn_lsr -
+//    Lists the directory and everything below it.  The segments are
+//    formatted in parallel, each into its own buffer, and the buffers
+//    are then written in order, so the output is the same as listing
+//    one directory after another.  Small trees are formatted serially,
+//    where starting threads would cost more than it saves.
+
+void fn_lsr (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   constexpr size_t PARALLEL_ENTRIES = 8192;
    inode_ptr currentDir;
    if(words.size() > 1){
-      currentDir = findNode(state, words[1]);
+      path_walk walk = resolve_path(state, words[1]);
+      if(walk.node == nullptr){
+         throw command_error (string(walk.leaf) + ": no such directory");
+      }
+      currentDir = walk.node;
    }
    else{
       currentDir = state.getCwd();
    }
-   if(currentDir == state.getRoot()){
-      cout << "/:" << endl;
-   } else{
-      cout  << currentDir->getPath() <<":"<<endl;
+   inode_table& table = state.getTable();
+   vector<lsr_segment> plan;
+   size_t entries = plan_lsr(table, currentDir, plan);
+   vector<string> buffers(plan.size());
+   auto render = [&](size_t index){
+      render_lsr(table, plan[index], buffers[index]);
+   };
+   if(entries < PARALLEL_ENTRIES){
+      for(size_t index = 0; index < plan.size(); ++index) render(index);
+   }else{
+      run_parallel(plan.size(), render);
    }
-   auto wordCopy = words;
-
-   for( auto mapObj : currentDir->getContents()->getdirents()){
-      if(mapObj.second->getContents()->fileType() == "file"){
-         auto inodePtr = mapObj.second;
-         cout << setw(6)<< inodePtr->get_inode_nr()
-            << setw(6)
-            << inodePtr->getContents()->size()
-            << "  " << mapObj.first
-            << endl;
-       }else{
-          wordCopy = words;
-
-          if(mapObj.first == "." || mapObj.first == ".."){
-             
-            auto inodePtr = mapObj.second;
-            cout << setw(6)<< inodePtr->get_inode_nr()
-               << setw(6)
-               << inodePtr->getContents()->size()
-               << "  " << mapObj.first << "/"
-               << endl;
-
-          }else{
-              if(words.size() > 1){
-                wordCopy[1] +="/";
-                wordCopy[1] += mapObj.first;
-             }else{
-                wordCopy.push_back(mapObj.first);
-             }
-             fn_lsr(state,wordCopy);
-          }
-       }
+   for(const auto& buffer : buffers){
+      state.out().write(buffer.data(), buffer.size());
    }
-
-
-
 }
 
-void fn_make (inode_state& state, const wordvec& words){
+void fn_make (inode_state& state, const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
-   string filename = "";
-   wordvec fileContents;
-   filename = words[1];
-   inode_ptr targetNode; 
-   if(filename.find("/") != string::npos){
-      size_t lastSlash = filename.find_last_of("/");
-      string path = filename.substr(0,lastSlash+1);
-      filename = filename.substr(lastSlash+1);
-      targetNode = findNode(state,path);
+   if(words.size() < 2){
+      throw command_error ("make: usage: make pathname [words]");
    }
-   else{
-      targetNode = state.getCwd();
+   path_walk walk = resolve_path(state, words[1]);
+   string filename {walk.leaf};
+   directory& dir = state.getTable().dir(*walk.parent);
+   auto writing = dir.writing();
+   journal_entry logged(state);
+   //an existing file is overwritten rather than shadowed, and looked
+   //up again, since another session may have made or removed it
+   auto file = walk.node;
+   if(not walk.leaf.empty()){
+      size_t nr = dir.lookup(filename);
+      file = nr != 0 ? &state.getTable()[nr] : dir.mkfile(filename);
    }
-   
-   for(long unsigned int pos = 2; pos < words.size(); pos++){
-      fileContents.push_back(words[pos]);
+   if(file->getContents()->fileType() == "directory"){
+      throw command_error (string(words[1]) + ": is a directory");
    }
-   auto file = targetNode->getContents()->mkfile(filename);
-   file->getContents()->writefile(fileContents);
-   file->setPath(targetNode->getPath()+"/"+filename);
+   wordview_range data (words.cbegin() + 2, words.cend());
+   state.getTable().writable(*file).writefile(data);
+   logged.make(*walk.parent, filename, data);
 }
 
-void fn_mkdir (inode_state& state, const wordvec& words){
-   //split vector between slashes
-   
-   string dirname = words[1];
-
-   inode_ptr targetNode;
-   if(dirname.find("/") != string::npos){
-      size_t lastSlash = dirname.find_last_of("/");
-      string path = dirname.substr(0,lastSlash+1);
-      dirname = dirname.substr(lastSlash+1);
-      targetNode = findNode(state,path);
-   }else{
-      targetNode = state.getCwd();
+void fn_mkdir (inode_state& state, const wordviews& words){
+   if(words.size() < 2){
+      throw command_error ("mkdir: usage: mkdir pathname");
    }
+   path_walk walk = resolve_path(state, words[1]);
+   string dirname {walk.leaf};
    //dont make directory named . or ..
-   if(dirname == "." || dirname == ".."){
+   if(dirname.empty() || dirname == "." || dirname == ".."){
       return;
    }
    //only make if target does not have same name directory
-   auto nodeToEnter = targetNode->getContents()->getdirents().find(dirname);
-   if(nodeToEnter == targetNode->getContents()->getdirents().end()){
-      auto dir = targetNode->getContents()->mkdir(dirname);
-      auto insertPair = pair<string,inode_ptr>("..", state.getCwd());
-      dir->getContents()->getdirents().insert(insertPair);
-      
-      dir->setPath(targetNode->getPath()+"/"+dirname);
-
+   if(walk.node == nullptr){
+      directory& dir = state.getTable().dir(*walk.parent);
+      auto writing = dir.writing();
+      journal_entry logged(state);
+      if(dir.getdirents().count(dirname) == 0){
+         dir.mkdir(dirname);
+         logged.mkdir(*walk.parent, dirname);
+      }
    }
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 }
 
-void fn_prompt (inode_state& state, const wordvec& words){
+void fn_prompt (inode_state& state, const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    string temp = "";
@@ -286,126 +859,177 @@ void fn_prompt (inode_state& state, const wordvec& words){
    state.changePrompt(temp);
 }
 
-void fn_pwd (inode_state& state, const wordvec& words){
+void fn_pwd (inode_state& state, [[maybe_unused]] const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    for(auto dir : state.getCwdPath()){
-      cout << "/" << dir;
+      state.out() << "/" << dir;
    }
-   cout<<endl;
+   state.out()<<"\n";
 }
 
-void fn_rm (inode_state& state, const wordvec& words){
-   DEBUGF ('c', state);
-   DEBUGF ('c', words);
+// check_removable -
+//    Throws unless the pathname names an entry rm or rmr may remove.
+//    Dot and dotdot, a pathname ending in the root, and the cwd or a
+//    directory above it all name a directory still in use, which
+//    would be freed under the session.
 
-   string filename = words[1];
-
-   inode_ptr targetNode;
-   if(filename.find("/") != string::npos){
-      size_t lastSlash = filename.find_last_of("/");
-      string path = filename.substr(0,lastSlash+1);
-      filename = filename.substr(lastSlash+1);
-      targetNode = findNode(state,path);
-   }else{
-      targetNode = state.getCwd();
+static void check_removable(inode_state& state, const path_walk& walk,
+                            string_view path){
+   if(walk.leaf.empty() || walk.leaf == "." || walk.leaf == ".."){
+      throw command_error (string(path) + ": cannot remove");
+   }
+   if(walk.node == nullptr) return;
+   inode_table& table = state.getTable();
+   for(inode_ptr node = state.getCwd();; node = &table[node->getParent()]){
+      if(node == walk.node){
+         throw command_error (string(path) + ": cannot remove");
+      }
+      if(node->getParent() == node->get_inode_nr()) break;
    }
-
-   targetNode->getContents()->remove(filename);
 }
 
-void fn_rmr (inode_state& state, const wordvec& words){
-   inode_ptr dir = findNode(state, words[1]);
+// fn_rm -
+//    Removes a plain file or an empty directory, never a directory
+//    with anything in it, which is left to rmr.  The directory
+//    emptied is locked as well as the parent, since beside other
+//    commands, another session may be making something in it.
 
-   wordvec parsedPath = split(words[1],"/");
-   string dirname = parsedPath.back();
-   inode_ptr parentDir;
-   string parentPath = "";
-   if(parsedPath.size() > 1){
-      parsedPath.pop_back();
-      for(auto word : parsedPath){
-         parentPath += word;
-      }
-      parentDir = findNode(state, parentPath);
-   }else{
-      parentDir = state.getCwd();
+void fn_rm (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(words.size() < 2){
+      throw command_error ("rm: usage: rm pathname");
    }
-   parentDir->getContents()->remove(dirname);
-   auto dirents = dir->getContents()->getdirents();
 
-   if(dirents.size() <= 2){
-      dir->getContents()->getdirents().clear();
-      dir->getContents() = nullptr;
-   }else{
-      for(auto entryPair : dirents){
-         if(entryPair.first != "." && entryPair.first != ".."){
-            preExitClear(entryPair.second);
-            dir->getContents()->getdirents().erase(entryPair.first);
-         }
+   path_walk walk = resolve_path(state, words[1]);
+   check_removable(state, walk, words[1]);
+   string name {walk.leaf};
+   directory& parent = state.getTable().dir(*walk.parent);
+   auto writing = parent.writing();
+   size_t nr = parent.lookup(name);
+   if(nr == 0) return;
+   auto& contents = state.getTable()[nr].getContents();
+   auto subdir = dynamic_cast<directory*>(contents.get());
+   unique_lock<mutex> emptying;
+   if(subdir != nullptr){
+      emptying = subdir->writing();
+      if(subdir->size() > 2){
+         throw command_error (name + ": directory is not empty");
       }
+   }
+   journal_entry logged(state);
+   parent.remove(name);
+   logged.remove(*walk.parent, name);
+}
 
-      dir->getContents()->getdirents().clear();
-      dir->getContents() = nullptr;
+void fn_rmr (inode_state& state, const wordviews& words){
+   if(words.size() < 2){
+      throw command_error ("rmr: usage: rmr pathname");
+   }
+   path_walk walk = resolve_path(state, words[1]);
+   check_removable(state, walk, words[1]);
+   if(walk.node == nullptr){
+      throw command_error (string(walk.leaf) + ": no such directory");
+   }
+   journal_entry logged(state);
+   state.getTable().dir(*walk.parent).remove(string(walk.leaf));
+   logged.remove(*walk.parent, walk.leaf);
+}
+
+void fn_save (inode_state& state, const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   if(words.size() < 2){
+      throw command_error ("save: missing image name");
    }
+   try{
+      save_image(state, string(words[1]));
+   }catch(image_error& error){
+      throw command_error (error.what());
+   }
+}
 
+void fn_stats (inode_state& state,
+               [[maybe_unused]] const wordviews& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+   command_stats::print (state.out(), state);
 }
 
-void fn_nothing (inode_state& state, const wordvec& words){
+void fn_nothing ([[maybe_unused]] inode_state& state,
+                 [[maybe_unused]] const wordviews& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 }
 
-inode_ptr findNode( inode_state& state, string path){
-   inode_ptr currDir;
-   if(path.at(0) == '/'){
-      currDir = state.getRoot();
-   }else{
-      currDir = state.getCwd();
-   }
-   wordvec parsedPath = split(path,"/");
-   map<string,inode_ptr> dirents;
-   for(auto word: parsedPath){
-      dirents = currDir->getContents()->getdirents();
+// find_directory -
+//    Resolves the directory part of a pathname relative to the
+//    absolute pathname key.  The pathname is first normalized by
+//    collapsing dot and dotdot, then looked up in the dentry cache,
+//    and only walked down from the root on a miss.
 
-      if(dirents.count(word) == 0){
-         throw command_error (word + ": no such directory");
+static inode_ptr find_directory(inode_state& state, string key,
+                                string_view dirs){
+   size_t pos = 0;
+   for(;;){
+      string_view word = next_component(dirs, pos);
+      if(word.empty()) break;
+      if(word == ".."){
+         size_t slash = key.rfind('/');
+         if(slash != string::npos) key.erase(slash);
+      }else if(word != "."){
+         key += '/';
+         key += word;
       }
-
-      currDir = dirents.find(word)->second;
    }
-   return currDir;
-   
-}
-
-void preExitClear(inode_ptr& node){
-   if(node->getContents()->fileType() == "file"){
-      node->getContents() = nullptr;
-      return;
+   dentry_cache& dcache = state.getDcache();
+   //sessions sharing the tree walk it without the cache
+   bool cached = not state.getFileSystem().concurrent();
+   if(size_t nr = cached ? dcache.find(key) : 0){
+      return &state.getTable()[nr];
    }
-   auto dirents = node->getContents()->getdirents();
-
-   if(dirents.size() <= 2){
-      node->getContents()->getdirents().clear();
-      //delete empty directory
-      node->getContents() = nullptr;
-   }else{
-      for(auto entryPair : dirents){
-         if(entryPair.first != "." && entryPair.first != ".."){
-            preExitClear(entryPair.second);
-            node->getContents()->getdirents().erase(entryPair.first);
-         }
+   inode_ptr node = state.getRoot();
+   pos = 0;
+   for(;;){
+      string_view word = next_component(key, pos);
+      if(word.empty()) break;
+      size_t found = state.getTable().dir(*node).lookup(word);
+      if(found == 0){
+         throw command_error (string(word) + ": no such directory");
+      }
+      node = &state.getTable()[found];
+      if(node->getContents()->fileType() != "directory"){
+         throw command_error (string(word) + ": not a directory");
       }
-
-      node->getContents()->getdirents().clear();
-      //delete empty directory
-      node->getContents() = nullptr;
    }
+   if(cached) dcache.insert(key, node->get_inode_nr());
+   return node;
 }
 
+path_walk resolve_path (inode_state& state, string_view view){
+   bool absolute = not view.empty() && view[0] == '/';
+   inode_ptr start = absolute ? state.getRoot() : state.getCwd();
+   size_t leafEnd = view.find_last_not_of('/');
+   if(leafEnd == string_view::npos){
+      return {start, {}, start};
+   }
+   size_t leafStart = view.find_last_of('/', leafEnd);
+   leafStart = leafStart == string_view::npos ? 0 : leafStart + 1;
+   string_view leaf = view.substr(leafStart, leafEnd + 1 - leafStart);
 
+   inode_ptr parent = start;
+   if(leafStart > 0){
+      parent = find_directory(state, absolute ? ""
+                                 : state.getTable().path(start->get_inode_nr()),
+                              view.substr(0, leafStart));
+   }
+   size_t found = state.getTable().dir(*parent).lookup(leaf);
+   return {parent, leaf,
+           found == 0 ? nullptr : &state.getTable()[found]};
+}
 
-
-int stringToInt(string str){
+int stringToInt(string_view str){
    int result = 0;
    for(auto digit : str){
       if(isdigit(digit)){
@@ -3,15 +3,18 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
+#include <string_view>
 #include <unordered_map>
 using namespace std;
 
 #include "file_sys.h"
 #include "util.h"
 
-// A couple of convenient usings to avoid verbosity.
+// A couple of convenient usings to avoid verbosity.  The words
+// passed to a command are views into the command line, valid only
+// until it returns, so a command copies whatever it keeps.
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
+using command_fn = void (*)(inode_state& state, const wordviews& words);
 using command_hash = unordered_map<string,command_fn>;
 
 // command_error -
@@ -25,21 +28,68 @@ class command_error: public runtime_error {
 
 // execution functions -
 
-void fn_cat    (inode_state& state, const wordvec& words);
-void fn_cd     (inode_state& state, const wordvec& words);
-void fn_echo   (inode_state& state, const wordvec& words);
-void fn_exit   (inode_state& state, const wordvec& words);
-void fn_ls     (inode_state& state, const wordvec& words);
-void fn_lsr    (inode_state& state, const wordvec& words);
-void fn_make   (inode_state& state, const wordvec& words);
-void fn_mkdir  (inode_state& state, const wordvec& words);
-void fn_prompt (inode_state& state, const wordvec& words);
-void fn_pwd    (inode_state& state, const wordvec& words);
-void fn_rm     (inode_state& state, const wordvec& words);
-void fn_rmr    (inode_state& state, const wordvec& words);
-void fn_nothing(inode_state& state, const wordvec& words);
-
-command_fn find_command_fn (const string& command);
+void fn_cat    (inode_state& state, const wordviews& words);
+void fn_cd     (inode_state& state, const wordviews& words);
+void fn_checkpoint (inode_state& state, const wordviews& words);
+void fn_cp     (inode_state& state, const wordviews& words);
+void fn_echo   (inode_state& state, const wordviews& words);
+void fn_exit   (inode_state& state, const wordviews& words);
+void fn_export (inode_state& state, const wordviews& words);
+void fn_grep   (inode_state& state, const wordviews& words);
+void fn_import (inode_state& state, const wordviews& words);
+void fn_ls     (inode_state& state, const wordviews& words);
+void fn_load   (inode_state& state, const wordviews& words);
+void fn_lsr    (inode_state& state, const wordviews& words);
+void fn_make   (inode_state& state, const wordviews& words);
+void fn_mkdir  (inode_state& state, const wordviews& words);
+void fn_prompt (inode_state& state, const wordviews& words);
+void fn_pwd    (inode_state& state, const wordviews& words);
+void fn_rm     (inode_state& state, const wordviews& words);
+void fn_rmr    (inode_state& state, const wordviews& words);
+void fn_save   (inode_state& state, const wordviews& words);
+void fn_stats  (inode_state& state, const wordviews& words);
+void fn_nothing(inode_state& state, const wordviews& words);
+
+// find_command_fn -
+//    Returns the function for a command, looking first in the table
+//    of built-in commands through a perfect hash made at compile time,
+//    then among any added by register_command.  Throws a command_error
+//    if there is none.
+// register_command -
+//    Adds a command at run time.  A built-in command of the same name
+//    still takes precedence.
+// runs_shared -
+//    Whether sessions sharing a filesystem may run a command line
+//    beside others for which it is true:  it uses only the
+//    directories its pathnames name, taking the locks of those it
+//    changes itself, makes nothing but plain files and empty
+//    directories, and removes nothing but those, which are freed
+//    once nobody can be reading them.  Only built-in commands may be.
+
+command_fn find_command_fn (string_view command);
+void register_command (const string& command, command_fn fn);
+bool runs_shared (inode_state& state, const wordviews& words);
+
+// path_walk -
+//    Result of resolving a pathname:  the directory holding the last
+//    component, the last component itself, and the inode it names,
+//    which is nullptr if there is no such entry.  The leaf is a view
+//    into the pathname, so it must not outlive it.
+// resolve_path -
+//    Finds the parent directory of the pathname, relative to the root
+//    (absolute) or the cwd (relative), through the dentry cache or by
+//    walking the tree by reference, throwing a command_error if an
+//    intermediate component is missing or is not a directory.  A
+//    pathname with no components names the starting directory itself,
+//    with an empty leaf.
+
+struct path_walk {
+   inode_ptr parent;
+   string_view leaf;
+   inode_ptr node;
+};
+
+path_walk resolve_path (inode_state& state, string_view path);
 
 // exit_status_message -
 //    Prints an exit message and returns the exit status, as recorded
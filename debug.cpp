@@ -1,7 +1,13 @@
 // $Id: debug.cpp,v 1.15 2020-01-22 14:21:55-08 - - $
 
+#include <algorithm>
+#include <chrono>
 #include <climits>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <vector>
 
 using namespace std;
@@ -11,19 +17,223 @@ using namespace std;
 
 debugflags::flagset_ debugflags::flags_ {};
 
+// trace_record -
+//    One trace, in a fixed size, so that tracing costs a clock read
+//    and a few stores.  A text record has no arguments; its message
+//    is kept beside it in the ring.
+
+struct trace_record {
+   int64_t nanos;
+   const trace_site* site;
+   size_t count;
+   int64_t args[debugflags::TRACE_ARGS];
+};
+
+// trace_ring -
+//    The last RING_SIZE traces made by one thread, the oldest being
+//    overwritten.  Written only by the thread holding it, and read
+//    only at exit, so it needs no locking.
+
+constexpr size_t RING_SIZE = 1 << 16;
+
+struct trace_ring {
+   vector<trace_record> records = vector<trace_record> (RING_SIZE);
+   vector<string> texts = vector<string> (RING_SIZE);
+   size_t made {0};
+   size_t claim() {return made++ % RING_SIZE;}
+};
+
+// trace_rings -
+//    Every ring made, and those whose thread has finished, for the
+//    next thread which traces to take over, so that threads made for
+//    each parallel task do not each leave a ring behind.
+
+struct trace_rings {
+   mutex lock;
+   vector<unique_ptr<trace_ring>> all;
+   vector<trace_ring*> idle;
+};
+
+static trace_rings& rings() {
+   static trace_rings result;
+   return result;
+}
+
+// ring_holder -
+//    The ring of the calling thread, taken on its first trace and
+//    given back when the thread finishes.
+
+struct ring_holder {
+   trace_ring* ring {nullptr};
+   trace_ring& get() {
+      if (ring != nullptr) return *ring;
+      trace_rings& all = rings();
+      lock_guard<mutex> guard (all.lock);
+      if (all.idle.empty()) {
+         all.all.push_back (make_unique<trace_ring>());
+         ring = all.all.back().get();
+      }else {
+         ring = all.idle.back();
+         all.idle.pop_back();
+      }
+      return *ring;
+   }
+   ~ring_holder() {
+      if (ring == nullptr) return;
+      trace_rings& all = rings();
+      lock_guard<mutex> guard (all.lock);
+      all.idle.push_back (ring);
+   }
+};
+
+static thread_local ring_holder this_ring;
+
+static const chrono::steady_clock::time_point trace_epoch
+      = chrono::steady_clock::now();
+
+static int64_t trace_nanos() {
+   return chrono::duration_cast<chrono::nanoseconds> (
+          chrono::steady_clock::now() - trace_epoch).count();
+}
+
+// decode_at_exit -
+//    Registered with atexit, so the rings are decoded however the
+//    program ends, after cout has been flushed.
+
+static void decode_at_exit() {
+   // Decoded into one string, since cerr would write each piece.
+   ostringstream out;
+   debugflags::decode (out);
+   cout.flush();
+   cerr << out.str();
+}
+
 void debugflags::setflags (const string& initflags) {
    for (const unsigned char flag: initflags) {
       if (flag == '@') flags_.set();
                   else flags_.set (flag, true);
    }
+   static bool registered = false;
+   if (flags_.any() and not registered) {
+      // Made first, so it is destroyed after decode_at_exit runs.
+      rings();
+      atexit (decode_at_exit);
+      registered = true;
+   }
+}
+
+void debugflags::record (const trace_site* site, size_t count,
+                         const int64_t* args) {
+   trace_ring& ring = this_ring.get();
+   trace_record& record = ring.records[ring.claim()];
+   record.nanos = trace_nanos();
+   record.site = site;
+   record.count = count;
+   copy (args, args + count, record.args);
 }
 
-// getflag -
-//    Check to see if a certain flag is on.
+// text_stream -
+//    A stream appending to a string, which keeps its capacity from one
+//    message to the next, as do the strings in the ring it is swapped
+//    with.
+
+class text_stream: public streambuf {
+   public:
+      string text;
+      ostream out {this};
+      text_stream() {out << boolalpha;}
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         if (ch != traits_type::eof()) text.push_back (ch);
+         return traits_type::not_eof (ch);
+      }
+      virtual streamsize xsputn (const char* chars,
+                                 streamsize count) override {
+         text.append (chars, count);
+         return count;
+      }
+};
+
+// text_streams -
+//    A stream for each level of DEBUGF nesting in the calling thread.
+
+struct text_streams {
+   vector<unique_ptr<text_stream>> streams;
+   size_t depth {0};
+};
+
+static thread_local text_streams these_streams;
+
+trace_text::trace_text (const trace_site* site_): site (site_) {
+   auto& streams = these_streams.streams;
+   size_t depth = these_streams.depth++;
+   if (depth == streams.size()) {
+      streams.push_back (make_unique<text_stream>());
+   }
+   out_ = &streams[depth]->out;
+}
 
-bool debugflags::getflag (char flag) {
-   // WARNING: Don't TRACE this function or the stack will blow up.
-   return flags_.test (static_cast<unsigned char> (flag));
+trace_text::~trace_text() {
+   text_stream& stream = *these_streams.streams[--these_streams.depth];
+   trace_ring& ring = this_ring.get();
+   size_t slot = ring.claim();
+   trace_record& record = ring.records[slot];
+   record.nanos = trace_nanos();
+   record.site = site;
+   record.count = 0;
+   swap (ring.texts[slot], stream.text);
+   stream.text.clear();
+}
+
+// decode_format -
+//    Prints the format of a trace, putting the next argument in place
+//    of each {}.
+
+static void decode_format (ostream& out, const trace_record& record) {
+   size_t arg = 0;
+   for (const char* chars = record.site->format; *chars != '\0';
+        ++chars) {
+      if (chars[0] == '{' and chars[1] == '}' and arg < record.count) {
+         out << record.args[arg++];
+         ++chars;
+      }else {
+         out << *chars;
+      }
+   }
+}
+
+void debugflags::decode (ostream& out) {
+   trace_rings& all = rings();
+   lock_guard<mutex> guard (all.lock);
+   struct held {
+      const trace_record* record;
+      const string* text;
+   };
+   vector<held> traces;
+   size_t lost = 0;
+   for (const auto& ring: all.all) {
+      size_t kept = min (ring->made, RING_SIZE);
+      lost += ring->made - kept;
+      for (size_t slot = 0; slot < kept; ++slot) {
+         traces.push_back ({&ring->records[slot], &ring->texts[slot]});
+      }
+   }
+   stable_sort (traces.begin(), traces.end(),
+                [] (const held& left, const held& right) {
+                   return left.record->nanos < right.record->nanos;
+                });
+   for (const auto& trace: traces) {
+      const trace_site* site = trace.record->site;
+      out << "DEBUG(" << site->flag << ") " << site->file << "["
+          << site->line << "] " << trace.record->nanos << " ns\n"
+          << "... " << site->function << "\n";
+      if (site->format == nullptr) out << *trace.text;
+                              else decode_format (out, *trace.record);
+      out << "\n";
+   }
+   if (lost > 0) {
+      out << "DEBUG: " << lost << " older traces overwritten" << endl;
+   }
 }
 
 void debugflags::where (char flag, const char* file, int line,
@@ -5,50 +5,137 @@
 
 #include <bitset>
 #include <climits>
+#include <cstdint>
+#include <iostream>
 #include <string>
+#include <type_traits>
 using namespace std;
 
+// trace_site -
+//    Where a trace is made:  its flag, file, line and function, and
+//    for TRACEF, its format, in which each {} stands for the next
+//    argument.  Made once per macro, so a trace record need only
+//    point at it.
+
+struct trace_site {
+   char flag;
+   const char* file;
+   int line;
+   const char* function;
+   const char* format;
+};
+
 // debug -
 //    static class for maintaining global debug flags.
 // setflags -
 //    Takes a string argument, and sets a flag for each char in the
-//    string.  As a special case, '@', sets all flags.
+//    string.  As a special case, '@', sets all flags.  Setting any
+//    flag arranges for the traces to be decoded at exit.
 // getflag -
 //    Used by the DEBUGF macro to check to see if a flag has been set.
 //    Not to be called by user code.
+// trace -
+//    Used by the TRACEF macro to add a record to the trace ring of the
+//    calling thread, with up to TRACE_ARGS integer arguments.
+// decode -
+//    Prints every trace still held in the rings of all threads, in
+//    the order they were made, and how many were overwritten.
 
 class debugflags {
    private:
       using flagset_ = bitset<UCHAR_MAX + 1>;
       static flagset_ flags_;
+      static void record (const trace_site* site, size_t count,
+                          const int64_t* args);
+      template <typename arg_t>
+      static int64_t trace_arg (arg_t arg) {
+         if constexpr (is_pointer_v<arg_t>) {
+            return reinterpret_cast<intptr_t> (arg);
+         }else {
+            return static_cast<int64_t> (arg);
+         }
+      }
    public:
+      static constexpr size_t TRACE_ARGS = 4;
       static void setflags (const string& optflags);
-      static bool getflag (char flag);
+      static bool getflag (char flag) {
+         // WARNING: Don't TRACE this function or the stack will blow up.
+         return flags_.test (static_cast<unsigned char> (flag));
+      }
+      template <typename... args_t>
+      static void trace (const trace_site* site, args_t... args) {
+         static_assert (sizeof... (args) <= TRACE_ARGS,
+                        "too many trace arguments");
+         // The leading zero keeps the array from being empty.
+         const int64_t values[] {0, trace_arg (args)...};
+         record (site, sizeof... (args), values + 1);
+      }
+      static void decode (ostream& out);
       static void where (char flag, const char* file, int line,
                          const char* pretty_function);
 };
 
-
+// trace_text -
+//    Used by the DEBUGF macro to add a record to the trace ring of the
+//    calling thread whose message is whatever is written to out, once
+//    it goes out of scope.  Traces made while the message is written
+//    have texts of their own, so may nest.
+
+class trace_text {
+   private:
+      const trace_site* site;
+      ostream* out_;
+   public:
+      explicit trace_text (const trace_site* site_);
+      trace_text (const trace_text&) = delete;
+      trace_text& operator= (const trace_text&) = delete;
+      ~trace_text();
+      ostream& out() {return *out_;}
+};
+
+
 // DEBUGF -
 //    Macro which expands into trace code.  First argument is a
 //    trace flag char, second argument is output code that can
 //    be sandwiched between <<.  Beware of operator precedence.
 //    Example:
 //       DEBUGF ('u', "foo = " << foo);
-//    will print two words and a newline if flag 'u' is  on.
-//    Traces are preceded by filename, line number, and function.
+//    will trace two words if flag 'u' is on.
+//    Traces are recorded with filename, line number, and function,
+//    and printed at exit.
+// TRACEF -
+//    As DEBUGF, but for the hot paths:  the arguments after the format
+//    must be integers or pointers, and are stored as they are, to be
+//    formatted only when decoded.  A single statement either way, so
+//    it may be the body of an if and takes a semicolon after it.
+//    Example:
+//       TRACEF ('u', "foo = {}, bar = {}", foo, bar);
+// DEBUGS -
+//    Runs the statement if the flag is on, printing at once rather
+//    than into the trace.
 
 #ifdef NDEBUG
 #define DEBUGF(FLAG,CODE) ;
+#define TRACEF(FLAG,...) do {} while (0)
 #define DEBUGS(FLAG,STMT) ;
 #else
 #define DEBUGF(FLAG,CODE) { \
            if (debugflags::getflag (FLAG)) { \
-              debugflags::where (FLAG, __FILE__, __LINE__, \
-                                 __PRETTY_FUNCTION__); \
-              cerr << CODE << endl; \
+              static const trace_site site_ {FLAG, __FILE__, __LINE__, \
+                                             __PRETTY_FUNCTION__, \
+                                             nullptr}; \
+              trace_text text_ (&site_); \
+              text_.out() << CODE; \
            } \
         }
+#define TRACEF(FLAG,FORMAT,...) do { \
+           if (debugflags::getflag (FLAG)) { \
+              static const trace_site site_ {FLAG, __FILE__, __LINE__, \
+                                             __PRETTY_FUNCTION__, \
+                                             FORMAT}; \
+              debugflags::trace (&site_, ##__VA_ARGS__); \
+           } \
+        } while (0)
 #define DEBUGS(FLAG,STMT) { \
            if (debugflags::getflag (FLAG)) { \
               debugflags::where (FLAG, __FILE__, __LINE__, \
@@ -0,0 +1,163 @@
+// $Id: dirents.cpp,v 1.1 2026-10-18 06:30:00-07 - - $
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+#include "debug.h"
+#include "dirents.h"
+
+using page = dirent_map::page;
+
+// lower_entry -
+//    Binary search of a page by name.  Returns the first entry not
+//    less than the name.
+
+static page::const_iterator lower_entry (const page& entries,
+                                         string_view name) {
+   return lower_bound (entries.begin(), entries.end(), name,
+             [] (const dirent_map::value_type& entry, string_view key) {
+                return string_view (entry.first) < key;
+             });
+}
+
+// find_page -
+//    Returns the index of the first page whose last name is not less
+//    than the name, which is the only page that can hold it, or the
+//    last page if the name is greater than every name.
+
+size_t dirent_map::find_page (const version& entries, string_view name) {
+   const auto& pages = entries.pages;
+   auto itor = lower_bound (pages.begin(), pages.end(), name,
+                  [] (const page* entries_, string_view key) {
+                     return string_view (entries_->back().first) < key;
+                  });
+   if (itor == pages.end() and not pages.empty()) --itor;
+   return itor - pages.begin();
+}
+
+// split -
+//    Splits the page in two if it is full.
+
+void dirent_map::split (version& entries, size_t page_nr) {
+   page& full = *entries.pages[page_nr];
+   if (full.size() < PAGE_SIZE) return;
+   TRACEF ('e', "split page {} of {}", page_nr, entries.pages.size());
+   auto upper = new page;
+   upper->reserve (PAGE_SIZE);
+   auto half = full.begin() + full.size() / 2;
+   upper->assign (make_move_iterator (half),
+                  make_move_iterator (full.end()));
+   full.erase (half, full.end());
+   entries.pages.insert (entries.pages.begin() + page_nr + 1, upper);
+}
+
+// publish -
+//    Makes the new version current and retires the old one along
+//    with the page the new one replaced, if any.
+
+void dirent_map::publish (version* next, page* stale,
+                          epoch_domain* readers) {
+   version* old = current.exchange (next, memory_order_acq_rel);
+   readers->retire ([old, stale] {
+      delete stale;
+      delete old;
+   });
+}
+
+dirent_map::~dirent_map() {
+   clear();
+   delete current.load (memory_order_relaxed);
+}
+
+size_t dirent_map::lookup (string_view name) const {
+   const version& entries = *latest();
+   if (entries.pages.empty()) return 0;
+   const page& found = *entries.pages[find_page (entries, name)];
+   auto entry = lower_entry (found, name);
+   if (entry == found.end() or entry->first != name) return 0;
+   return entry->second;
+}
+
+size_t dirent_map::at (string_view name) const {
+   size_t nr = lookup (name);
+   if (nr == 0) throw out_of_range (string (name) + ": no such entry");
+   return nr;
+}
+
+bool dirent_map::insert (value_type entry, epoch_domain* readers) {
+   version* entries = latest();
+   if (entries->pages.empty()) {
+      auto first = new page;
+      first->reserve (PAGE_SIZE);
+      first->push_back (move (entry));
+      if (readers == nullptr) {
+         entries->pages.push_back (first);
+      }else {
+         publish (new version {{first}}, nullptr, readers);
+      }
+      set_live (size() + 1);
+      return true;
+   }
+   size_t page_nr = find_page (*entries, entry.first);
+   const page& found = *entries->pages[page_nr];
+   auto pos = lower_entry (found, entry.first);
+   if (pos != found.end() and pos->first == entry.first) return false;
+   if (readers == nullptr) {
+      size_t index = pos - found.begin();
+      page& changed = *entries->pages[page_nr];
+      changed.insert (changed.begin() + index, move (entry));
+      split (*entries, page_nr);
+   }else {
+      auto next = new version {entries->pages};
+      auto changed = new page;
+      changed->reserve (PAGE_SIZE);
+      changed->assign (found.begin(), pos);
+      changed->push_back (move (entry));
+      changed->insert (changed->end(), pos, found.end());
+      next->pages[page_nr] = changed;
+      split (*next, page_nr);
+      publish (next, entries->pages[page_nr], readers);
+   }
+   set_live (size() + 1);
+   return true;
+}
+
+bool dirent_map::erase (string_view name, epoch_domain* readers) {
+   version* entries = latest();
+   if (entries->pages.empty()) return false;
+   size_t page_nr = find_page (*entries, name);
+   page* found = entries->pages[page_nr];
+   auto pos = lower_entry (*found, name);
+   if (pos == found->end() or pos->first != name) return false;
+   if (readers == nullptr) {
+      found->erase (pos);
+      if (found->empty()) {
+         delete found;
+         entries->pages.erase (entries->pages.begin() + page_nr);
+      }
+   }else {
+      auto next = new version {entries->pages};
+      if (found->size() == 1) {
+         next->pages.erase (next->pages.begin() + page_nr);
+      }else {
+         auto changed = new page;
+         changed->reserve (PAGE_SIZE);
+         changed->assign (found->cbegin(), pos);
+         changed->insert (changed->end(), pos + 1, found->cend());
+         next->pages[page_nr] = changed;
+      }
+      publish (next, found, readers);
+   }
+   set_live (size() - 1);
+   return true;
+}
+
+void dirent_map::clear() {
+   version* entries = latest();
+   for (page* entries_page: entries->pages) delete entries_page;
+   entries->pages.clear();
+   set_live (0);
+}
@@ -0,0 +1,140 @@
+// $Id: dirents.h,v 1.1 2026-10-18 06:30:00-07 - - $
+
+// dirents -
+//    The container a directory uses to map names onto inode numbers.
+
+#ifndef __DIRENTS_H__
+#define __DIRENTS_H__
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "epoch.h"
+
+// dirent_map -
+//    An ordered map from names onto inode numbers, kept as a sorted
+//    sequence of pages, each a sorted vector of at most PAGE_SIZE
+//    entries:  a B+ tree of height two.  Lookups and listings stay
+//    within a few cache lines even with a million entries, and names
+//    up to the short string size are stored inline in the pages.  An
+//    insert or erase shifts at most one page.  A full page is split
+//    in half, and an emptied page is dropped.
+//    The pages are reached through a version, which lists them in
+//    order.  Given an epoch_domain, insert and erase leave the
+//    current version and its pages as they are, for readers on other
+//    threads, who take no locks:  they copy the page they change and
+//    the list of pages into a new version, publish it, and retire
+//    what it replaced.  Given none, they change it in place, which is
+//    all the caller may do while nothing else reads the map.  Writers
+//    are never concurrent with each other.
+// lookup -
+//    Returns the inode number of the entry, or 0 if there is none.
+// at -
+//    As lookup, but throws out_of_range if there is no such entry.
+// insert -
+//    Adds the entry unless the name is already present, and returns
+//    whether it did.
+// erase -
+//    Removes the entry with the given name, returning whether there
+//    was one.
+// clear -
+//    Frees every entry at once, in place.
+// size -
+//    Returns the number of entries.
+// begin, end -
+//    Iterate over the entries of the current version in lexicographic
+//    order.  Iterators are invalidated by any insert or erase made in
+//    place.
+// snapshot -
+//    Returns the current version to iterate over, as a reader does,
+//    which a writer on another thread does not change.
+
+class dirent_map {
+   public:
+      using value_type = pair<string,size_t>;
+      using page = vector<value_type>;
+      static constexpr size_t PAGE_SIZE = 64;
+      struct version {
+         vector<page*> pages;
+      };
+      class const_iterator {
+         private:
+            const vector<page*>* pages;
+            size_t page_nr;
+            size_t index;
+         public:
+            const_iterator (const vector<page*>* pages_,
+                            size_t page_nr_, size_t index_):
+                     pages (pages_), page_nr (page_nr_), index (index_) {}
+            const value_type& operator*() const {
+               return (*(*pages)[page_nr])[index];
+            }
+            const value_type* operator->() const {return &**this;}
+            const_iterator& operator++() {
+               if (++index == (*pages)[page_nr]->size()) {
+                  ++page_nr;
+                  index = 0;
+               }
+               return *this;
+            }
+            bool operator== (const const_iterator& that) const {
+               return page_nr == that.page_nr and index == that.index;
+            }
+            bool operator!= (const const_iterator& that) const {
+               return not (*this == that);
+            }
+      };
+      class view {
+         private:
+            const version* entries;
+         public:
+            explicit view (const version* entries_):
+                           entries (entries_) {}
+            const_iterator begin() const {
+               return {&entries->pages, 0, 0};
+            }
+            const_iterator end() const {
+               return {&entries->pages, entries->pages.size(), 0};
+            }
+      };
+   private:
+      // Never null, so readers need not check.
+      atomic<version*> current {new version};
+      // Relaxed, since only the writer changes it, so counting an
+      // entry is still a plain load and store.
+      atomic<size_t> live {0};
+      void set_live (size_t count) {
+         live.store (count, memory_order_relaxed);
+      }
+      version* latest() const {
+         return current.load (memory_order_acquire);
+      }
+      static size_t find_page (const version& entries, string_view name);
+      static void split (version& entries, size_t page_nr);
+      void publish (version* next, page* stale, epoch_domain* readers);
+   public:
+      dirent_map() = default;
+      dirent_map (const dirent_map&) = delete;
+      dirent_map& operator= (const dirent_map&) = delete;
+      ~dirent_map();
+      size_t lookup (string_view name) const;
+      size_t at (string_view name) const;
+      size_t count (string_view name) const {
+         return lookup (name) == 0 ? 0 : 1;
+      }
+      bool insert (value_type entry, epoch_domain* readers = nullptr);
+      bool erase (string_view name, epoch_domain* readers = nullptr);
+      void clear();
+      size_t size() const {return live.load (memory_order_relaxed);}
+      bool empty() const {return size() == 0;}
+      view snapshot() const {return view (latest());}
+      const_iterator begin() const {return snapshot().begin();}
+      const_iterator end() const {return snapshot().end();}
+};
+
+#endif
+
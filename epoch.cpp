@@ -0,0 +1,140 @@
+// $Id: epoch.cpp,v 1.1 2026-10-18 11:00:00-07 - - $
+
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+#include "debug.h"
+#include "epoch.h"
+
+// global_epoch -
+//    Advanced by every retire.  A reader pins the value it finds, so
+//    a thing retired at epoch e may be seen by a reader pinned at or
+//    before e, but not by one pinned after.
+
+static atomic<uint64_t> global_epoch {1};
+
+// reader_slot -
+//    The epoch at which a thread is pinned, or 0 while it reads
+//    nothing.  Only the thread holding the slot writes it.  Aligned
+//    so that pinning does not steal the cache line of another slot.
+
+struct alignas(64) reader_slot {
+   atomic<uint64_t> pinned {0};
+   size_t depth {0};
+};
+
+// reader_slots -
+//    Every slot made, and those whose thread has finished, for the
+//    next thread which reads to take over.  The lock is taken by a
+//    thread only the first time it reads, and by collect.
+
+struct reader_slots {
+   mutex lock;
+   vector<unique_ptr<reader_slot>> all;
+   vector<reader_slot*> idle;
+};
+
+static reader_slots& slots() {
+   static reader_slots result;
+   return result;
+}
+
+// slot_holder -
+//    The slot of the calling thread, taken on its first read and
+//    given back when the thread finishes.
+
+struct slot_holder {
+   reader_slot* slot {nullptr};
+   reader_slot& get() {
+      if (slot != nullptr) return *slot;
+      reader_slots& all = slots();
+      lock_guard<mutex> guard (all.lock);
+      if (all.idle.empty()) {
+         all.all.push_back (make_unique<reader_slot>());
+         slot = all.all.back().get();
+      }else {
+         slot = all.idle.back();
+         all.idle.pop_back();
+      }
+      return *slot;
+   }
+   ~slot_holder() {
+      if (slot == nullptr) return;
+      reader_slots& all = slots();
+      lock_guard<mutex> guard (all.lock);
+      all.idle.push_back (slot);
+   }
+};
+
+static thread_local slot_holder this_slot;
+
+// reader -
+//    The fence orders the store pinning the thread before the loads
+//    of whatever it then reads, as retire orders the stores unlinking
+//    a thing before the load of the epoch it is retired at, so either
+//    the reader sees the thing unlinked or collect sees it pinned.
+//    The pin is stored with release, as the unpin is, so whatever the
+//    thread read before is ordered before the free by collect even if
+//    collect sees it pinned again rather than unpinned.
+
+epoch_domain::reader::reader() {
+   reader_slot& slot = this_slot.get();
+   if (slot.depth++ > 0) return;
+   slot.pinned.store (global_epoch.load (memory_order_acquire),
+                      memory_order_release);
+   atomic_thread_fence (memory_order_seq_cst);
+}
+
+epoch_domain::reader::~reader() {
+   reader_slot& slot = this_slot.get();
+   if (--slot.depth > 0) return;
+   slot.pinned.store (0, memory_order_release);
+}
+
+epoch_domain::~epoch_domain() {
+   for (auto& thing: limbo) thing.free();
+}
+
+void epoch_domain::retire (function<void()> free) {
+   atomic_thread_fence (memory_order_seq_cst);
+   lock_guard<mutex> guard (lock);
+   uint64_t epoch = global_epoch.fetch_add (1);
+   limbo.push_back ({epoch, move (free)});
+}
+
+size_t epoch_domain::collect() {
+   uint64_t oldest = UINT64_MAX;
+   {
+      reader_slots& all = slots();
+      atomic_thread_fence (memory_order_seq_cst);
+      lock_guard<mutex> guard (all.lock);
+      for (const auto& slot: all.all) {
+         uint64_t pinned = slot->pinned.load (memory_order_acquire);
+         if (pinned != 0) oldest = min (oldest, pinned);
+      }
+   }
+   vector<retired> ready;
+   {
+      lock_guard<mutex> guard (lock);
+      // Retired in order of epoch, since the epoch is taken under
+      // the lock, so those ready are a prefix.
+      auto first_kept = find_if (limbo.begin(), limbo.end(),
+                           [oldest] (const retired& thing) {
+                              return thing.epoch >= oldest;
+                           });
+      ready.assign (make_move_iterator (limbo.begin()),
+                    make_move_iterator (first_kept));
+      limbo.erase (limbo.begin(), first_kept);
+   }
+   for (auto& thing: ready) thing.free();
+   if (not ready.empty()) TRACEF ('r', "freed = {}", ready.size());
+   return ready.size();
+}
+
+size_t epoch_domain::pending() {
+   lock_guard<mutex> guard (lock);
+   return limbo.size();
+}
+
@@ -0,0 +1,68 @@
+// $Id: epoch.h,v 1.1 2026-10-18 11:00:00-07 - - $
+
+// epoch -
+//    Epoch-based reclamation, so that threads reading a structure
+//    shared between sessions take no locks and touch no reference
+//    counts while others change it.  A writer publishes a new version
+//    of what it changes, then retires the old one, which is freed
+//    only once every reader which might still see it has left.
+
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+// epoch_domain -
+//    Holds what has been retired until it can be freed.  Readers are
+//    kept track of per thread, once for every domain, so a thread
+//    reading several structures is pinned once.
+// reader -
+//    Pins the calling thread for as long as it lives:  nothing retired
+//    by any domain after it was made is freed before it goes.  Costs
+//    a load, a store and a fence, and only the outermost of nested
+//    readers does even that.
+// retire -
+//    Takes a function freeing something which the caller has just
+//    unlinked, to be called once no reader can still be looking at it.
+// collect -
+//    Calls the functions of everything retired before the oldest
+//    reader still pinned was made, and returns how many it called.
+//    Called by writers between commands, never while pinned, since
+//    then nothing they retired could be freed.
+// pending -
+//    Returns the number of functions not yet called.
+// dtor -
+//    Calls every function still pending.  No reader may be left.
+
+class epoch_domain {
+   private:
+      struct retired {
+         uint64_t epoch;
+         function<void()> free;
+      };
+      mutex lock;
+      vector<retired> limbo;
+   public:
+      class reader {
+         public:
+            reader();
+            ~reader();
+            reader (const reader&) = delete;
+            reader& operator= (const reader&) = delete;
+      };
+      epoch_domain() = default;
+      epoch_domain (const epoch_domain&) = delete;
+      epoch_domain& operator= (const epoch_domain&) = delete;
+      ~epoch_domain();
+      void retire (function<void()> free);
+      size_t collect();
+      size_t pending();
+};
+
+#endif
+
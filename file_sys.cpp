@@ -1,5 +1,8 @@
 // $Id: file_sys.cpp,v 1.7 2019-07-09 14:05:44-07 - - $
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <unordered_map>
@@ -8,8 +11,6 @@ using namespace std;
 #include "debug.h"
 #include "file_sys.h"
 
-size_t inode::next_inode_nr {1};
-
 struct file_type_hash {
    size_t operator() (file_type type) const {
       return static_cast<size_t> (type);
@@ -24,40 +25,454 @@ ostream& operator<< (ostream& out, file_type type) {
    return out << hash[type];
 }
 
-// inode state =====================================================
+// dentry cache ====================================================
+
+size_t dentry_cache::find (string_view path) {
+   auto found = entries.find (path);
+   if (found != entries.end()) {
+      ++hits_;
+      return found->second;
+   }
+   ++misses_;
+   return 0;
+}
+
+void dentry_cache::insert (const string& path, size_t inode_nr) {
+   entries.insert_or_assign (path, inode_nr);
+}
+
+void dentry_cache::invalidate (string_view path) {
+   DEBUGF ('d', path);
+   // Everything at or below path sorts at or after it, but so may
+   // siblings sharing its prefix, such as "/ab" after "/a".
+   auto itor = entries.lower_bound (path);
+   while (itor != entries.end()
+          and itor->first.compare (0, path.size(), path) == 0) {
+      if (itor->first.size() == path.size()
+          or itor->first[path.size()] == '/') {
+         itor = entries.erase (itor);
+      }else {
+         ++itor;
+      }
+   }
+}
+
+ostream& operator<< (ostream& out, const dentry_cache& cache) {
+   out << "dentry_cache: entries = " << cache.size()
+       << ", hits = " << cache.hits() << ", misses = " << cache.misses();
+   return out;
+}
+
+// file arena ======================================================
+
+size_t file_arena::size_class (size_t bytes) {
+   size_t cls = MIN_CLASS;
+   while ((size_t(1) << cls) < bytes) ++cls;
+   return cls;
+}
+
+char* file_arena::allocate (size_t bytes) {
+   size_t cls = size_class (bytes);
+   size_t rounded = size_t(1) << cls;
+   auto held = lock_if (lock, concurrent);
+   in_use_ += rounded;
+   if (cls > MAX_CLASS) {
+      reserved_ += rounded;
+      return new char[rounded];
+   }
+   char* block = free_lists[cls];
+   if (block != nullptr) {
+      // A free block holds the pointer to the next one in the list.
+      memcpy (&free_lists[cls], block, sizeof block);
+      return block;
+   }
+   if (left < rounded) {
+      chunks.emplace_back (new char[CHUNK_SIZE]);
+      next = chunks.back().get();
+      left = CHUNK_SIZE;
+      reserved_ += CHUNK_SIZE;
+   }
+   block = next;
+   next += rounded;
+   left -= rounded;
+   return block;
+}
+
+void file_arena::deallocate (char* block, size_t bytes) {
+   if (block == nullptr) return;
+   size_t cls = size_class (bytes);
+   auto held = lock_if (lock, concurrent);
+   in_use_ -= size_t(1) << cls;
+   if (cls > MAX_CLASS) {
+      reserved_ -= size_t(1) << cls;
+      delete[] block;
+      return;
+   }
+   memcpy (block, &free_lists[cls], sizeof block);
+   free_lists[cls] = block;
+}
+
+ostream& operator<< (ostream& out, const file_arena& arena) {
+   out << "file_arena: in_use = " << arena.in_use()
+       << ", reserved = " << arena.reserved()
+       << ", chunks = " << arena.chunks.size();
+   return out;
+}
+
+ostream& operator<< (ostream& out, const file_words& words) {
+   for (size_t index = 0; index < words.size(); ++index) {
+      if (index > 0) out << " ";
+      out << words[index];
+   }
+   return out;
+}
+
+// blob store ======================================================
+
+// block_header -
+//    The number of words in a block, followed by the index.
+
+static const uint32_t* block_header (const char* block) {
+   return reinterpret_cast<const uint32_t*> (block);
+}
+
+static size_t block_size (const char* block) {
+   const uint32_t* header = block_header (block);
+   return (header[0] + 2) * sizeof *header + header[header[0] + 1];
+}
+
+static file_words block_words (const char* block) {
+   const uint32_t* header = block_header (block);
+   size_t words = header[0];
+   return {header + 1, block + (words + 2) * sizeof *header, words};
+}
+
+// hash_words -
+//    Hashes each word on its own and mixes in the results, so views
+//    of the words of a command line and the same words already in a
+//    block hash alike.
+
+template <typename word_iter>
+static uint64_t hash_words (word_iter first, word_iter last,
+                            size_t count) {
+   uint64_t hash = count;
+   for (; first != last; ++first) {
+      hash = (hash ^ std::hash<string_view>() (*first))
+           * 0x100000001B3ULL;
+   }
+   return hash;
+}
+
+blob_store::blob_store (file_arena& arena_):
+            arena (arena_), buckets (1024, nullptr) {
+}
+
+// find -
+//    Looks for a block holding the count words from first, and takes
+//    a reference to it if there is one.  Called holding the lock.
+
+template <typename word_iter>
+char* blob_store::find (uint64_t hash, word_iter first, size_t count) {
+   for (blob* entry = buckets[hash & (buckets.size() - 1)];
+        entry != nullptr; entry = entry->next) {
+      if (entry->hash != hash) continue;
+      char* data = reinterpret_cast<char*> (entry + 1);
+      file_words have = block_words (data);
+      if (have.size() != count) continue;
+      auto word = first;
+      size_t index = 0;
+      while (index < count and have[index] == *word) {
+         ++index;
+         ++word;
+      }
+      if (index < count) continue;
+      ++entry->refs;
+      ++references_;
+      logical_ += block_size (data);
+      return data;
+   }
+   return nullptr;
+}
+
+// insert -
+//    Interns a block just filled, unless another thread has meanwhile
+//    interned the same words, whose block is returned instead.  The
+//    hash table is doubled once there are as many blocks as chains.
+
+char* blob_store::insert (uint64_t hash, char* data) {
+   file_words words = block_words (data);
+   size_t bytes = block_size (data);
+   auto held = lock_if (lock, concurrent);
+   char* found = find (hash, words.begin(), words.size());
+   if (found != nullptr) {
+      // Never interned, so nobody else can see it.
+      arena.deallocate (data - sizeof (blob), sizeof (blob) + bytes);
+      return found;
+   }
+   if (blobs_ >= buckets.size()) {
+      vector<blob*> grown (buckets.size() * 2, nullptr);
+      for (blob* chain: buckets) {
+         while (chain != nullptr) {
+            blob* next = chain->next;
+            blob*& head = grown[chain->hash & (grown.size() - 1)];
+            chain->next = head;
+            head = chain;
+            chain = next;
+         }
+      }
+      buckets.swap (grown);
+   }
+   blob* entry = reinterpret_cast<blob*> (data - sizeof (blob));
+   blob*& head = buckets[hash & (buckets.size() - 1)];
+   *entry = {hash, head, 1, nullptr, words_index.add (words)};
+   head = entry;
+   if (entry->slot >= by_slot.size()) by_slot.resize (entry->slot + 1);
+   by_slot[entry->slot] = entry;
+   ++blobs_;
+   ++references_;
+   stored_ += bytes;
+   logical_ += bytes;
+   return data;
+}
+
+char* blob_store::intern (const wordview_range& words) {
+   size_t count = words.second - words.first;
+   if (count == 0) return nullptr;
+   uint64_t hash = hash_words (words.first, words.second, count);
+   {
+      auto held = lock_if (lock, concurrent);
+      char* found = find (hash, words.first, count);
+      if (found != nullptr) return found;
+   }
+   size_t text = count;
+   for (auto word = words.first; word != words.second; ++word) {
+      text += word->size();
+   }
+   if (text > UINT32_MAX) {
+      throw file_error ("is too large");
+   }
+   size_t indexSize = (count + 2) * sizeof (uint32_t);
+   char* data = arena.allocate (sizeof (blob) + indexSize + text)
+              + sizeof (blob);
+   uint32_t* header = reinterpret_cast<uint32_t*> (data);
+   header[0] = count;
+   uint32_t* offsets = header + 1;
+   uint32_t offset = 0;
+   for (size_t index = 0; index < count; ++index) {
+      string_view word = words.first[index];
+      offsets[index] = offset;
+      memcpy (data + indexSize + offset, word.data(), word.size());
+      offset += word.size();
+      data[indexSize + offset++] = ' ';
+   }
+   offsets[count] = offset;
+   return insert (hash, data);
+}
+
+char* blob_store::intern (const file_words& words) {
+   if (words.empty()) return nullptr;
+   uint64_t hash = hash_words (words.begin(), words.end(),
+                               words.size());
+   {
+      auto held = lock_if (lock, concurrent);
+      char* found = find (hash, words.begin(), words.size());
+      if (found != nullptr) return found;
+   }
+   // The view may start partway into another block, so rebase its
+   // offsets to start at zero.
+   size_t text = words.text().size();
+   size_t indexSize = (words.size() + 2) * sizeof (uint32_t);
+   char* data = arena.allocate (sizeof (blob) + indexSize + text)
+              + sizeof (blob);
+   uint32_t* header = reinterpret_cast<uint32_t*> (data);
+   header[0] = words.size();
+   const uint32_t* from = words.index();
+   for (size_t index = 0; index <= words.size(); ++index) {
+      header[index + 1] = from[index] - from[0];
+   }
+   memcpy (data + indexSize, words.text().data(), text);
+   return insert (hash, data);
+}
+
+void blob_store::hold (plain_file* file, const char* data) {
+   blob* entry = reinterpret_cast<blob*> (const_cast<char*> (data)
+                                          - sizeof (blob));
+   auto held = lock_if (lock, concurrent);
+   file->prev_sharer = nullptr;
+   file->next_sharer = entry->files;
+   if (entry->files != nullptr) entry->files->prev_sharer = file;
+   entry->files = file;
+}
+
+bool blob_store::release (plain_file* file, const char* data) {
+   blob* entry = reinterpret_cast<blob*> (const_cast<char*> (data)
+                                          - sizeof (blob));
+   if (closed) return --entry->refs == 0;
+   size_t bytes = block_size (data);
+   auto held = lock_if (lock, concurrent);
+   if (file->prev_sharer != nullptr) {
+      file->prev_sharer->next_sharer = file->next_sharer;
+   }else if (entry->files == file) {
+      entry->files = file->next_sharer;
+   }
+   if (file->next_sharer != nullptr) {
+      file->next_sharer->prev_sharer = file->prev_sharer;
+   }
+   file->prev_sharer = file->next_sharer = nullptr;
+   --references_;
+   logical_ -= bytes;
+   if (--entry->refs > 0) return false;
+   blob** link = &buckets[entry->hash & (buckets.size() - 1)];
+   while (*link != entry) link = &(*link)->next;
+   *link = entry->next;
+   words_index.remove (entry->slot, block_words (data));
+   by_slot[entry->slot] = nullptr;
+   --blobs_;
+   stored_ -= bytes;
+   return true;
+}
+
+void blob_store::free (const char* data) {
+   arena.deallocate (const_cast<char*> (data) - sizeof (blob),
+                     sizeof (blob) + block_size (data));
+}
+
+uint32_t blob_store::slot (const char* data) {
+   return reinterpret_cast<const blob*> (data - sizeof (blob))->slot;
+}
+
+vector<word_index::posting> blob_store::find_word (string_view word) {
+   auto held = lock_if (lock, concurrent);
+   return words_index.find (word);
+}
 
-inode_state::inode_state() {
+vector<const plain_file*> blob_store::files (uint32_t slot) {
+   vector<const plain_file*> result;
+   auto held = lock_if (lock, concurrent);
+   if (slot >= by_slot.size() or by_slot[slot] == nullptr) return result;
+   for (const plain_file* file = by_slot[slot]->files; file != nullptr;
+        file = file->next_sharer) {
+      result.push_back (file);
+   }
+   return result;
+}
+
+ostream& operator<< (ostream& out, const blob_store& store) {
+   out << "blob_store: blobs = " << store.blobs()
+       << ", references = " << store.references()
+       << ", stored = " << store.stored()
+       << ", logical = " << store.logical() << ", ratio = "
+       << (store.stored() == 0 ? 1.0
+           : double (store.logical()) / store.stored());
+   return out;
+}
+
+// filesystem ======================================================
+
+file_system::file_system() {
    //initializing root of tree
-   root = make_shared<inode>(file_type::DIRECTORY_TYPE);
-   cwd = root;
-   //two new pointers in map (".",root) and ("..",root)
-   root->contents->getdirents()
-      .insert(pair<string,inode_ptr>(".",root));
-   root->contents->getdirents()
-      .insert(pair<string,inode_ptr>("..",root));
-   DEBUGF ('i', "root = " << root << ", cwd = " << cwd
-          << ", prompt = \"" << prompt() << "\"");
+   root = table.alloc(file_type::DIRECTORY_TYPE);
+   root->link(root->get_inode_nr(), "");
+   auto dir = dynamic_pointer_cast<directory> (root->getContents());
+   dir->attach (this);
+   //two entries in map (".",root) and ("..",root)
+   dir->set_dots (root->get_inode_nr(), root->get_inode_nr());
+   DEBUGF ('i', "root = " << root);
+}
+
+// resetRoot -
+//    Installs a new tree, as after loading an image.  Everything
+//    cached about the old one is dropped.
+
+void file_system::resetRoot(inode_ptr newRoot){
+   root = newRoot;
+   dcache.clear();
+   dynamic_pointer_cast<directory> (root->getContents())->attach (this);
+}
+
+void file_system::set_concurrent (bool on) {
+   concurrent_ = on;
+   arena.set_concurrent (on);
+   blobs.set_concurrent (on);
+   table.set_concurrent (on);
+   dcache.clear();
+   if (not on) epochs_.collect();
+}
+
+void file_system::retire (function<void()> free) {
+   if (tree_shared()) epochs_.retire (move (free));
+                 else free();
+}
+
+// inode state =====================================================
+
+inode_state::inode_state(): own_fs (make_unique<file_system>()),
+                            fs (*own_fs), cwd (fs.getRoot()) {
+   DEBUGF ('i', "cwd = " << cwd << ", prompt = \"" << prompt() << "\"");
+}
+
+inode_state::inode_state (file_system& shared, ostream& out):
+             fs (shared), cwd (fs.getRoot()), out_ (&out),
+             changes_seen (fs.changes()) {
+   DEBUGF ('i', "cwd = " << cwd << ", prompt = \"" << prompt() << "\"");
 }
 
 const string& inode_state::prompt() const { return prompt_; }
 
 ostream& operator<< (ostream& out, const inode_state& state) {
-   out << "inode_state: root = " << state.root
-       << ", cwd = " << state.cwd;
+   out << "inode_state: root = " << state.fs.getRoot()->get_inode_nr()
+       << ", cwd = " << state.cwd->get_inode_nr()
+       << ", live inodes = " << state.fs.getTable().live();
    return out;
 }
 
 
+// resetRoot -
+//    Installs a new tree, as after loading an image, and the cwd
+//    becomes /.
+
+void inode_state::resetRoot(inode_ptr newRoot){
+   fs.resetRoot(newRoot);
+   cwd = newRoot;
+   cwdPath.clear();
+}
+
+void inode_state::follow_changes(){
+   uint64_t changes = fs.changes();
+   if(changes == changes_seen) return;
+   changes_seen = changes;
+   inode_table& table = fs.getTable();
+   inode_ptr node = fs.getRoot();
+   for(const auto& name : cwdPath){
+      auto dir = dynamic_cast<directory*>(node->getContents().get());
+      size_t nr = dir == nullptr ? 0 : table.dir(*node).lookup(name);
+      if(nr == 0){
+         node = nullptr;
+         break;
+      }
+      node = &table[nr];
+   }
+   auto dir = node == nullptr ? nullptr
+              : dynamic_cast<directory*>(node->getContents().get());
+   if(dir == nullptr){
+      // The old cwd may already be freed.
+      TRACEF ('i', "cwd is gone, {} deep", cwdPath.size());
+      node = fs.getRoot();
+      cwdPath.clear();
+   }
+   cwd = node;
+}
+
 void inode_state::changePrompt(const string str){
    prompt_ = str;
 }
 
 
 //inode ============================================================
-inode::inode(file_type type): inode_nr (next_inode_nr++) {
+inode::inode(size_t nr, file_type type): inode_nr (nr) {
    switch (type) {
       case file_type::PLAIN_TYPE:
-           contents = make_shared<plain_file>();
+           contents = make_shared<plain_file> (nr);
            break;
       case file_type::DIRECTORY_TYPE:
            contents = make_shared<directory>();
@@ -66,21 +481,340 @@ inode::inode(file_type type): inode_nr (next_inode_nr++) {
    DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
 }
 
-int inode::get_inode_nr() const {
-   DEBUGF ('i', "inode = " << inode_nr);
+size_t inode::get_inode_nr() const {
+   TRACEF ('i', "inode = {}", inode_nr);
    return inode_nr;
 }
 
+//inode table ======================================================
+
+// grow -
+//    Adds an unused inode at the end of the table.  A new chunk is
+//    reserved in full, so adding to it moves nothing.
+
+inode& inode_table::grow() {
+   size_t index = count & (CHUNK_SIZE - 1);
+   if (index == 0) {
+      if (chunks.size() == MAX_CHUNKS) {
+         throw file_error ("inode table is full");
+      }
+      chunks.emplace_back();
+      chunks.back().reserve (CHUNK_SIZE);
+   }
+   chunks.back().emplace_back (++count);
+   return chunks.back()[index];
+}
+
+// slot -
+//    Returns an unused inode with no contents, reusing the number most
+//    recently released if there is one.  The table grows only once
+//    nothing is left to reclaim.  Called with the lock held.
+
+inode& inode_table::slot() {
+   if (free_list.empty()) free_doomed (RECLAIM_BATCH);
+   if (free_list.empty()) return grow();
+   size_t nr = free_list.back();
+   free_list.pop_back();
+   return (*this)[nr];
+}
+
+inode_ptr inode_table::alloc (file_type type) {
+   auto held = lock_if (lock, concurrent);
+   inode& node = slot();
+   node = inode (node.inode_nr, type);
+   return &node;
+}
+
+inode_ptr inode_table::restore (size_t nr, file_type type) {
+   while (count < nr) grow();
+   inode& node = (*this)[nr];
+   node = inode (nr, type);
+   return &node;
+}
+
+void inode_table::finish_restore() {
+   free_list.clear();
+   for (size_t nr = count; nr > 0; --nr) {
+      if ((*this)[nr].contents == nullptr) free_list.push_back (nr);
+   }
+}
+
+void inode_table::clear() {
+   chunks.clear();
+   count = 0;
+   free_list.clear();
+   doomed.clear();
+   sharing = 0;
+}
+
+size_t inode_table::dirent_count() const {
+   size_t entries = 0;
+   for (const auto& chunk: chunks) {
+      for (const inode& node: chunk) {
+         auto dir = dynamic_cast<const directory*>
+                    (node.contents.get());
+         if (dir != nullptr
+             and dir->dirents.lookup (".") == node.inode_nr) {
+            entries += dir->dirents.size();
+         }
+      }
+   }
+   return entries;
+}
+
+void inode_table::release (size_t nr) {
+   TRACEF ('i', "inode = {}, deferred = {}", nr, deferred);
+   auto held = lock_if (lock, concurrent);
+   doomed.push_back (nr);
+   if (not deferred) free_doomed (SIZE_MAX);
+}
+
+size_t inode_table::reclaim (size_t limit) {
+   auto held = lock_if (lock, concurrent);
+   return free_doomed (limit);
+}
+
+// free_doomed -
+//    Frees inodes off the doomed stack until limit inodes have been
+//    freed.  A directory is first marked as expanded and its entries
+//    pushed above it, in reverse so the first is freed first, and is
+//    itself freed once they are gone.  That is the order in which
+//    recursion would free them, so numbers are reused in the same
+//    order as ever.  Never recurses, so a deep chain of directories
+//    needs no more stack than a wide one.  Called with the lock held.
+
+size_t inode_table::free_doomed (size_t limit) {
+   constexpr size_t EXPANDED = ~(SIZE_MAX >> 1);
+   size_t freed = 0;
+   while (freed < limit and not doomed.empty()) {
+      size_t nr = doomed.back() & ~EXPANDED;
+      bool expanded = doomed.back() & EXPANDED;
+      inode& node = (*this)[nr];
+      auto dir = dynamic_cast<directory*> (node.contents.get());
+      if (dir != nullptr and not expanded) {
+         auto& clones = dir->clones;
+         if (dir->dirents.at (".") != nr) {
+            // A clone which never needed entries of its own.
+            clones.erase (find (clones.begin(), clones.end(), nr));
+            --sharing;
+         }else if (not clones.empty()) {
+            hand_down (*dir);
+         }else {
+            doomed.back() |= EXPANDED;
+            size_t first = doomed.size();
+            for (const auto& entry: dir->dirents) {
+               if (entry.first != "." and entry.first != "..") {
+                  doomed.push_back (entry.second);
+               }
+            }
+            reverse (doomed.begin() + first, doomed.end());
+            continue;
+         }
+      }
+      doomed.pop_back();
+      if (dir == nullptr and node.contents != nullptr) {
+         static_cast<plain_file&> (*node.contents).drop_holder (nr);
+      }
+      node.contents = nullptr;
+      node.name.clear();
+      node.parent_nr = 0;
+      free_list.push_back (nr);
+      ++freed;
+   }
+   if (freed > 0) TRACEF ('i', "freed = {}, doomed = {}", freed,
+                          doomed.size());
+   return freed;
+}
+
+// hand_down -
+//    The entries of a directory being freed outlive its inode, so
+//    they are given to a clone rather than copied into it.
+
+void inode_table::hand_down (directory& dir) {
+   inode& heir = (*this)[dir.clones.back()];
+   dir.clones.pop_back();
+   --sharing;
+   TRACEF ('i', "inode {} hands down to {}", dir.dirents.at ("."),
+           heir.inode_nr);
+   dir.set_dots (heir.inode_nr, heir.parent_nr);
+   for (const auto& entry: dir.dirents) {
+      if (entry.first == "." or entry.first == "..") continue;
+      inode& child = (*this)[entry.second];
+      child.parent_nr = heir.inode_nr;
+      auto subdir = dynamic_cast<directory*> (child.contents.get());
+      if (subdir != nullptr
+          and subdir->dirents.at (".") == child.inode_nr) {
+         subdir->set_dots (child.inode_nr, heir.inode_nr);
+      }
+   }
+}
+
+string inode_table::path (size_t nr) {
+   vector<const string*> names;
+   for (inode* node = &(*this)[nr]; node->parent_nr != node->inode_nr;
+        node = &(*this)[node->parent_nr]) {
+      names.push_back (&node->name);
+   }
+   string result;
+   for (auto name = names.rbegin(); name != names.rend(); ++name) {
+      result += '/';
+      result += **name;
+   }
+   return result;
+}
+
+inode_ptr inode_table::clone (inode& node) {
+   base_file_ptr contents = node.contents;
+   auto held = lock_if (lock, concurrent);
+   inode& copy = slot();
+   copy.contents = move (contents);
+   auto dir = dynamic_cast<directory*> (copy.contents.get());
+   if (dir != nullptr) {
+      dir->clones.push_back (copy.inode_nr);
+      ++sharing;
+   }else {
+      static_cast<plain_file&> (*copy.contents).clones.push_back
+            (copy.inode_nr);
+   }
+   TRACEF ('i', "inode {} clones {}", copy.inode_nr, node.inode_nr);
+   return &copy;
+}
+
+// materialize -
+//    Gives a directory clone entries of its own, each a clone of the
+//    entry it shared, and stops it sharing.  Costs one inode per
+//    entry, but nothing below them.
+
+void inode_table::materialize (inode& node) {
+   base_file_ptr shared = node.contents;
+   auto& from = dynamic_cast<directory&> (*shared);
+   auto own = make_shared<directory>();
+   own->attach (from.fs);
+   own->set_dots (node.inode_nr, node.parent_nr);
+   for (const auto& entry: from.dirents) {
+      if (entry.first == "." or entry.first == "..") continue;
+      inode_ptr copy = clone ((*this)[entry.second]);
+      copy->link (node.inode_nr, entry.first);
+      own->dirents.insert ({entry.first, copy->inode_nr});
+   }
+   own->bytes_ = from.bytes();
+   from.clones.erase (find (from.clones.begin(), from.clones.end(),
+                            node.inode_nr));
+   --sharing;
+   node.contents = move (own);
+   TRACEF ('i', "inode {} materialized, {} entries", node.inode_nr,
+           from.dirents.size());
+   // Anything cached below the clone named inodes it no longer holds.
+   from.fs->getDcache().invalidate (path (node.inode_nr));
+}
+
+directory& inode_table::dir (inode& node) {
+   auto contents = dynamic_cast<directory*> (node.contents.get());
+   if (contents == nullptr) throw file_error ("is a plain file");
+   // Only a clone's "." names another inode, and with none left the
+   // entries need not be read, as another session may be writing them.
+   if (sharing > 0 and contents->dirents.at (".") != node.inode_nr) {
+      materialize (node);
+      contents = static_cast<directory*> (node.contents.get());
+   }
+   return *contents;
+}
+
+void inode_table::prepare_write (inode& node) {
+   // Without clones there is nothing to unshare, and no need to walk
+   // up what may be a long chain of directories.
+   if (sharing == 0) return;
+   vector<inode*> chain {&node};
+   while (chain.back()->parent_nr != chain.back()->inode_nr) {
+      chain.push_back (&(*this)[chain.back()->parent_nr]);
+   }
+   // From the root down, since giving a clone its own entries makes
+   // new clones of the directories one level below.
+   for (auto up = chain.rbegin(); up != chain.rend(); ++up) {
+      directory& contents = dir (**up);
+      while (not contents.clones.empty()) {
+         materialize ((*this)[contents.clones.back()]);
+      }
+   }
+}
+
+plain_file& inode_table::writable (inode& node) {
+   inode& parent = (*this)[node.parent_nr];
+   prepare_write (parent);
+   directory& owner = dir (parent);
+   if (dynamic_cast<plain_file*> (node.contents.get()) == nullptr) {
+      throw file_error ("is a directory");
+   }
+   if (node.contents.use_count() > 1) {
+      auto copy = make_shared<plain_file> (node.inode_nr);
+      copy->setOwner (nullptr, owner.fs);
+      copy->writefile (node.contents->readfile());
+      {
+         auto held = lock_if (lock, concurrent);
+         static_cast<plain_file&> (*node.contents).drop_holder
+               (node.inode_nr);
+      }
+      node.contents = move (copy);
+   }
+   auto& file = static_cast<plain_file&> (*node.contents);
+   // The directory the file was made in may have gone to a clone.
+   file.setOwner (&owner, owner.fs);
+   return file;
+}
+
+void inode_table::file_paths (const plain_file& file,
+                              vector<string>& paths) {
+   // Each frame is an inode on the way up from one of the file's
+   // names, and below the frame it was reached from.
+   constexpr size_t NONE = SIZE_MAX;
+   struct frame {size_t nr; size_t below;};
+   vector<frame> frames;
+   vector<size_t> pending;
+   auto reach = [&] (size_t nr, size_t below) {
+      pending.push_back (frames.size());
+      frames.push_back ({nr, below});
+   };
+   if (file.holder != 0) reach (file.holder, NONE);
+   for (size_t nr: file.clones) reach (nr, NONE);
+   while (not pending.empty()) {
+      size_t at = pending.back();
+      pending.pop_back();
+      inode& node = (*this)[frames[at].nr];
+      if (node.parent_nr == node.inode_nr) {
+         string path;
+         for (size_t down = frames[at].below; down != NONE;
+              down = frames[down].below) {
+            path += '/';
+            path += (*this)[frames[down].nr].name;
+         }
+         paths.push_back (move (path));
+         continue;
+      }
+      // Entries live in the directory their parent owns, shared with
+      // its clones, and an inode no longer entered there is unlinked.
+      auto dir = dynamic_cast<directory*>
+                 ((*this)[node.parent_nr].contents.get());
+      if (dir == nullptr or dir->dirents.lookup (node.name)
+                            != node.inode_nr) continue;
+      reach (node.parent_nr, at);
+      for (size_t nr: dir->clones) reach (nr, at);
+   }
+}
+
 
 file_error::file_error (const string& what):
             runtime_error (what) {
 }
 
-const wordvec& base_file::readfile() const {
+file_words base_file::readfile() const {
+   throw file_error ("is a " + error_file_type());
+}
+
+void base_file::writefile (const wordview_range&) {
    throw file_error ("is a " + error_file_type());
 }
 
-void base_file::writefile (const wordvec&) {
+void base_file::writefile (const file_words&) {
    throw file_error ("is a " + error_file_type());
 }
 
@@ -99,29 +833,74 @@ inode_ptr base_file::mkfile (const string&) {
 // File inode
 
 size_t plain_file::size() const {
-   size_t size = 0;
-   if(data.size() == 0){
-      return 0;
+   const char* data = block.load(memory_order_acquire);
+   if(data == nullptr) return 0;
+   //the space after the last word is not counted
+   const uint32_t* header = block_header(data);
+   return header[header[0] + 1] - 1;
+}
+
+plain_file::~plain_file() {
+   char* data = block.load(memory_order_relaxed);
+   if(data != nullptr and fs->getBlobs().release(this, data)){
+      fs->getBlobs().free(data);
    }
-   for(auto word : data){
-      size += word.size();
+}
+
+file_words plain_file::readfile() const {
+   const char* data = block.load(memory_order_acquire);
+   if(data == nullptr) return {};
+   file_words contents = block_words(data);
+   TRACEF ('i', "words = {}, size = {}", contents.size(),
+           contents.text().size());
+   return contents;
+}
+
+void plain_file::drop_holder (size_t nr) {
+   if(holder != nr){
+      auto found = find(clones.begin(), clones.end(), nr);
+      if(found != clones.end()) clones.erase(found);
+   }else if(clones.empty()){
+      holder = 0;
+   }else {
+      holder = clones.back();
+      clones.pop_back();
    }
-   if(size>0){
-      //add in the spaces
-      size += data.size()-1;
+}
+
+uint32_t plain_file::slot() const {
+   const char* data = block.load(memory_order_acquire);
+   return data == nullptr ? 0 : blob_store::slot(data);
+}
+
+void plain_file::writefile (const wordview_range& words) {
+   TRACEF ('i', "words = {}", words.second - words.first);
+   if(fs == nullptr){
+      throw file_error ("is not in a directory");
    }
-   return size;
+   replace(fs->getBlobs().intern(words));
 }
 
-const wordvec& plain_file::readfile() const {
-   DEBUGF ('i', data);
-   return data;
+void plain_file::writefile (const file_words& words) {
+   TRACEF ('i', "words = {}", words.size());
+   if(fs == nullptr){
+      throw file_error ("is not in a directory");
+   }
+   replace(fs->getBlobs().intern(words));
 }
 
-void plain_file::writefile (const wordvec& words) {
-   DEBUGF ('i', words);
-   data.clear();
-   data = words;
+void plain_file::replace (char* newBlock) {
+   size_t oldSize = size();
+   char* old = block.exchange(newBlock, memory_order_acq_rel);
+   if(old != nullptr and fs->getBlobs().release(this, old)){
+      blob_store* blobs = &fs->getBlobs();
+      fs->retire([blobs, old]{blobs->free(old);});
+   }
+   if(newBlock != nullptr) fs->getBlobs().hold(this, newBlock);
+   if(owner != nullptr){
+      owner->adjustBytes(static_cast<ptrdiff_t>(size())
+                         - static_cast<ptrdiff_t>(oldSize));
+   }
 }
 
 //Directory inode
@@ -130,26 +909,136 @@ size_t directory::size() const {
    return dirents.size();
 }
 
+void directory::adjustBytes (ptrdiff_t delta) {
+   directory* dir = this;
+   for(;;){
+      [[maybe_unused]] size_t bytes
+            = dir->bytes_.fetch_add(delta, memory_order_relaxed);
+      TRACEF ('i', "bytes = {}", bytes + delta);
+      inode& parentNode = fs->getTable()[dir->dotdot];
+      auto parent = dynamic_cast<directory*>
+                    (parentNode.getContents().get());
+      if(parent == nullptr || parent == dir) break;
+      dir = parent;
+   }
+}
+
+void directory::recountBytes () {
+   size_t total = 0;
+   for(const auto& entry : dirents){
+      if(entry.first == "." || entry.first == "..") continue;
+      auto& contents = fs->getTable()[entry.second].getContents();
+      auto subdir = dynamic_cast<directory*>(contents.get());
+      total += subdir != nullptr ? subdir->bytes() : contents->size();
+   }
+   bytes_ = total;
+}
+
 void directory::remove (const string& filename) {
    DEBUGF ('i', filename);
-   dirents.erase(filename);
+   //dot and dotdot are this directory and its parent, still in use
+   if(filename.empty() || filename == "." || filename == ".."){
+      throw file_error (filename + ": cannot remove");
+   }
+   size_t nr = dirents.lookup(filename);
+   if(nr == 0){
+      return;
+   }
+   inode_table& table = fs->getTable();
+   table.prepare_write(table[dirents.at(".")]);
+   inode& node = table[nr];
+   auto& contents = node.getContents();
+   auto subdir = dynamic_cast<directory*>(contents.get());
+   // Only directories are cached.
+   if(subdir != nullptr && fs->getDcache().size() > 0){
+      fs->getDcache().invalidate(table.path(nr));
+   }
+   size_t removed = subdir != nullptr ? subdir->bytes() : contents->size();
+   dirents.erase(filename, readers());
+   // With the tree shared, no clone can hold the same entries.
+   if(subdir != nullptr && fs->tree_shared()){
+      subdir->unlinked_ = true;
+      fs->changed();
+   }
+   if(removed > 0){
+      adjustBytes(-static_cast<ptrdiff_t>(removed));
+   }
+   fs->retire([&table, nr]{table.release(nr);});
 }
 
 inode_ptr directory::mkdir (const string& dirname) {
    DEBUGF ('i', dirname);
-   inode_ptr dir = make_shared<inode>(file_type::DIRECTORY_TYPE);
-   //insert dot into new directory
-   (dir->getContents())->getdirents()
-      .insert(pair<string,inode_ptr>(".",dir));
-   dirents.insert(pair<string,inode_ptr>(dirname, dir));  
+   if(unlinked_){
+      throw file_error (dirname + ": directory was removed");
+   }
+   if(dirents.count(dirname) > 0){
+      throw file_error (dirname + ": file exists");
+   }
+   inode_table& table = fs->getTable();
+   table.prepare_write(table[dirents.at(".")]);
+   inode_ptr dir = table.alloc(file_type::DIRECTORY_TYPE);
+   size_t nr = dir->get_inode_nr();
+   //insert dot and dotdot into new directory
+   auto subdir = dynamic_pointer_cast<directory>(dir->getContents());
+   subdir->set_dots(nr, dirents.at("."));
+   subdir->attach(fs);
+   dir->link(dirents.at("."), dirname);
+   dirents.insert(pair<string,size_t>(dirname, nr), readers());
    return dir;
 }
 
 inode_ptr directory::mkfile (const string& filename) {
    DEBUGF ('i', filename);
-   
-   inode_ptr file = make_shared<inode>(file_type::PLAIN_TYPE);
-   dirents.insert(pair<string,inode_ptr>(filename, file));
+   if(unlinked_){
+      throw file_error (filename + ": directory was removed");
+   }
+   if(dirents.count(filename) > 0){
+      throw file_error (filename + ": file exists");
+   }
+   inode_table& table = fs->getTable();
+   table.prepare_write(table[dirents.at(".")]);
+   inode_ptr file = table.alloc(file_type::PLAIN_TYPE);
+   file->link(dirents.at("."), filename);
+   dynamic_pointer_cast<plain_file>(file->getContents())
+      ->setOwner(this, fs);
+   dirents.insert(pair<string,size_t>(filename, file->get_inode_nr()),
+                  readers());
    return file;
 }
 
+void directory::link (const string& name, inode_ptr node) {
+   DEBUGF ('i', name << " = inode " << node->get_inode_nr());
+   if(dirents.count(name) > 0){
+      throw file_error (name + ": file exists");
+   }
+   inode_table& table = fs->getTable();
+   // Linked first, since making the clones above this directory
+   // unshare may give the new inode entries of its own.
+   node->link(dirents.at("."), name);
+   table.prepare_write(table[dirents.at(".")]);
+   dirents.insert(pair<string,size_t>(name, node->get_inode_nr()),
+                  readers());
+   auto& contents = node->getContents();
+   auto subdir = dynamic_cast<directory*>(contents.get());
+   size_t added = subdir != nullptr ? subdir->bytes() : contents->size();
+   if(added > 0){
+      adjustBytes(static_cast<ptrdiff_t>(added));
+   }
+}
+
+// set_dots -
+//    Changes the entries in place, since it is only used on a
+//    directory nobody else can see yet, or with the tree not shared.
+
+void directory::set_dots (size_t self, size_t parent) {
+   dirents.erase(".");
+   dirents.erase("..");
+   dirents.insert(pair<string,size_t>(".", self));
+   dirents.insert(pair<string,size_t>("..", parent));
+   dotdot = parent;
+}
+
+epoch_domain* directory::readers() const {
+   return fs->tree_shared() ? &fs->epochs() : nullptr;
+}
+
@@ -3,13 +3,23 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
 #include <vector>
 using namespace std;
 
+#include "dirents.h"
+#include "epoch.h"
+#include "index.h"
 #include "util.h"
 
 // inode_t -
@@ -20,65 +30,525 @@ class inode;
 class base_file;
 class plain_file;
 class directory;
-using inode_ptr = shared_ptr<inode>;
+class journal;
+// Inodes are owned by the inode_table, so an inode_ptr does not own.
+using inode_ptr = inode*;
 using base_file_ptr = shared_ptr<base_file>;
 ostream& operator<< (ostream&, file_type);
 
+
+// dentry_cache -
+//    Maps normalized absolute pathnames onto the directories they
+//    named when last resolved, so repeated lookups of deep paths do
+//    not walk the tree again.  The root is the empty pathname.  Kept
+//    ordered so that invalidating a pathname also drops everything
+//    beneath it as one range.
+// find -
+//    Returns the cached inode number, or 0, and counts a hit or miss.
+// invalidate -
+//    Drops the pathname and every cached pathname below it.
+//
+// Not used while the filesystem is concurrent, when paths are walked
+// without locks, since even a find counts a hit or a miss.
+
+class dentry_cache {
+   friend ostream& operator<< (ostream& out, const dentry_cache&);
+   private:
+      map<string,size_t,less<>> entries;
+      size_t hits_ {0};
+      size_t misses_ {0};
+   public:
+      size_t find (string_view path);
+      void insert (const string& path, size_t inode_nr);
+      void invalidate (string_view path);
+      void clear() {entries.clear();}
+      size_t hits() const {return hits_;}
+      size_t misses() const {return misses_;}
+      size_t size() const {return entries.size();}
+};
+
 
-// inode_state -
-//    A small convenient class to maintain the state of the simulated
-//    process:  the root (/), the current directory (.), and the
-//    prompt.
+// file_arena -
+//    Allocates the storage of the plain files of one filesystem out
+//    of large chunks, so each file is one contiguous block and small
+//    files do not each pay for a heap allocation per word.  Blocks are
+//    rounded up to a power of two and freed blocks are recycled by
+//    size class.  Blocks too big for a chunk come from the heap.
+// in_use -
+//    Returns the number of bytes in blocks handed out.
+// reserved -
+//    Returns the number of bytes obtained from the heap.
+// set_concurrent -
+//    Turns on locking, needed once sessions write files of the same
+//    filesystem at once.
 
-class inode_state {
-   friend class inode;
-   friend ostream& operator<< (ostream& out, const inode_state&);
+class file_arena {
+   friend ostream& operator<< (ostream& out, const file_arena&);
    private:
-      inode_ptr root {nullptr};
-      inode_ptr cwd {nullptr};
-      string prompt_ {"% "};
-      wordvec cwdPath {};
+      static constexpr size_t MIN_CLASS = 4;
+      static constexpr size_t MAX_CLASS = 18;
+      static constexpr size_t CHUNK_SIZE = size_t(1) << 20;
+      vector<unique_ptr<char[]>> chunks;
+      char* next {nullptr};
+      size_t left {0};
+      array<char*,MAX_CLASS + 1> free_lists {};
+      size_t in_use_ {0};
+      size_t reserved_ {0};
+      mutex lock;
+      bool concurrent {false};
+      static size_t size_class (size_t bytes);
    public:
-      inode_state (const inode_state&) = delete; // copy ctor
-      inode_state& operator= (const inode_state&) = delete; // op=
-      inode_state();
-      inode_ptr& getRoot(){return root;}
-      inode_ptr& getCwd(){return cwd;}
-      const string& prompt() const;
-      void changePrompt(const string);
-      void changeCwd(inode_ptr ptr){cwd = ptr;}
-      wordvec& getCwdPath(){return cwdPath;}
+      file_arena() = default;
+      file_arena (const file_arena&) = delete;
+      file_arena& operator= (const file_arena&) = delete;
+      char* allocate (size_t bytes);
+      void deallocate (char* block, size_t bytes);
+      size_t in_use() const {return in_use_;}
+      size_t reserved() const {return reserved_;}
+      void set_concurrent (bool on) {concurrent = on;}
+};
+
+// file_words -
+//    A read-only view of the words of a plain file, handed out as
+//    string_views into the file's block without copying.  Valid
+//    until the file is next written or destroyed.
+// index, text -
+//    The offset of each word plus one past the end, and all of the
+//    words back to back, each followed by a space, which is how a
+//    plain file stores them.  The text is then exactly what cat
+//    prints for the file, and is written out in one piece.
+
+class file_words {
+   private:
+      const uint32_t* offsets {nullptr};
+      const char* chars {nullptr};
+      size_t count {0};
+   public:
+      class iterator {
+         private:
+            const file_words* words;
+            size_t index;
+         public:
+            iterator (const file_words* words_, size_t index_):
+                      words (words_), index (index_) {}
+            string_view operator*() const {return (*words)[index];}
+            iterator& operator++() {++index; return *this;}
+            bool operator!= (const iterator& that) const {
+               return index != that.index;
+            }
+      };
+      file_words() = default;
+      file_words (const uint32_t* offsets_, const char* text_,
+                  size_t count_):
+                  offsets (offsets_), chars (text_), count (count_) {}
+      size_t size() const {return count;}
+      bool empty() const {return count == 0;}
+      const uint32_t* index() const {return offsets;}
+      string_view text() const {
+         if (count == 0) return {};
+         return {chars + offsets[0], offsets[count] - offsets[0]};
+      }
+      string_view operator[] (size_t index) const {
+         return {chars + offsets[index],
+                 offsets[index + 1] - offsets[index] - 1};
+      }
+      iterator begin() const {return {this, 0};}
+      iterator end() const {return {this, count};}
+};
+
+ostream& operator<< (ostream&, const file_words&);
+
+// blob_store -
+//    Keeps one copy of each distinct contents of the plain files of a
+//    filesystem.  A block is laid out as plain_file describes, after a
+//    header holding a hash of its words, the next block in its hash
+//    chain, the number of files holding it and the first of them, and
+//    its slot in the word index, which indexes the words of every
+//    block as blocks come and go.  Blocks are immutable once interned,
+//    so files of the same contents share one, and a file written is
+//    given another block rather than changing its own.
+// intern -
+//    Returns a block holding the given words, found by their hash or
+//    else made from the arena, with a reference taken for the caller.
+//    Nullptr if there are no words.
+// hold -
+//    Chains the file to the others holding the block interned for it,
+//    so the files holding a block are found from its slot.
+// release -
+//    Unchains the file and drops its reference to the block, returning
+//    true if it was the last, when the block is no longer found by
+//    intern and must be given to free once nobody can be reading it.
+// free -
+//    Returns a released block to the arena.
+// close -
+//    Called as the filesystem is destroyed, after which release only
+//    counts references, so files give back their blocks without the
+//    hash chains or the word index being kept up to date.
+// slot -
+//    Returns the slot of a block interned here in the word index.
+// find_word -
+//    Returns the postings of the word from the index.
+// files -
+//    Returns the files holding the block in the slot, if any.
+// blobs, references, stored, logical -
+//    The number of distinct blocks and of the references to them, and
+//    the bytes of data in the blocks once and as many times as they
+//    are referred to.  Their ratio is what sharing saves.
+// getIndex -
+//    The word index, for its gauges.
+// set_concurrent -
+//    Turns on locking, needed once sessions write files of the same
+//    filesystem at once.
+
+class blob_store {
+   friend ostream& operator<< (ostream& out, const blob_store&);
+   private:
+      struct blob {
+         uint64_t hash;
+         blob* next;
+         size_t refs;
+         plain_file* files;
+         uint32_t slot;
+      };
+      file_arena& arena;
+      vector<blob*> buckets;
+      word_index words_index;
+      vector<blob*> by_slot;
+      size_t blobs_ {0};
+      size_t references_ {0};
+      size_t stored_ {0};
+      size_t logical_ {0};
+      mutex lock;
+      bool concurrent {false};
+      bool closed {false};
+      template <typename word_iter>
+      char* find (uint64_t hash, word_iter first, size_t count);
+      char* insert (uint64_t hash, char* data);
+   public:
+      explicit blob_store (file_arena& arena_);
+      blob_store (const blob_store&) = delete;
+      blob_store& operator= (const blob_store&) = delete;
+      char* intern (const wordview_range& words);
+      char* intern (const file_words& words);
+      void hold (plain_file* file, const char* data);
+      bool release (plain_file* file, const char* data);
+      void free (const char* data);
+      void close() {closed = true;}
+      static uint32_t slot (const char* data);
+      vector<word_index::posting> find_word (string_view word);
+      vector<const plain_file*> files (uint32_t slot);
+      size_t blobs() const {return blobs_;}
+      size_t references() const {return references_;}
+      size_t stored() const {return stored_;}
+      size_t logical() const {return logical_;}
+      const word_index& getIndex() const {return words_index;}
+      void set_concurrent (bool on) {concurrent = on;}
 };
 
 // class inode -
 // inode ctor -
-//    Create a new inode of the given type.
+//    Create a new inode of the given type and number, or without a
+//    type, an unused slot.  Only the inode_table makes inodes.  The
+//    parent and name of a new inode are set by the directory which
+//    enters it.
 // get_inode_nr -
-//    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
+//    Retrieves the serial number of the inode, which is also its
+//    index in the inode table.
 // size -
 //    Returns the size of an inode.  For a directory, this is the
 //    number of dirents.  For a text file, the number of characters
 //    when printed (the sum of the lengths of each word, plus the
 //    number of words.
+// link -
+//    Records the directory whose entries hold this inode and its name
+//    there.  The root is its own parent and has an empty name.  Full
+//    pathnames are not stored, so a subtree can change hands without
+//    visiting everything in it; see inode_table::path.
 //    
 
 class inode {
-   friend class inode_state;
+   friend class inode_table;
    private:
-      string pathname;
-      static size_t next_inode_nr;
+      string name;
       size_t inode_nr;
+      size_t parent_nr {0};
       base_file_ptr contents;
    public:
-      inode (file_type);
-      int get_inode_nr() const;
+      explicit inode (size_t nr): inode_nr (nr) {}
+      inode (size_t nr, file_type);
+      size_t get_inode_nr() const;
+      size_t getParent() const {return parent_nr;}
+      const string& getName() const {return name;}
       base_file_ptr& getContents(){return contents;}
-      string getPath(){return pathname;}
-      void setPath(string path){pathname = path;}
-      
+      void link(size_t parent, const string& newName){
+         parent_nr = parent;
+         name = newName;
+      }
 };
 
+// inode_table -
+//    Owns every inode of a filesystem, addressed by inode number, so
+//    directories refer to their entries by number and nothing is
+//    reference counted.  Inodes are kept in chunks which are never
+//    reallocated, listed in a vector reserved up front, so each inode
+//    stays in place as the table grows and an inode_ptr stays valid
+//    until it is released.
+// operator[] -
+//    Returns the inode with the given number.  Needs no lock, even
+//    while another thread adds to the table.
+// alloc -
+//    Returns a new inode of the given type, reusing the number most
+//    recently released if there is one.
+// release -
+//    Frees the inode and, if it is a directory, everything below it
+//    which no clone still shares, putting their numbers on the free
+//    list.  A directory whose entries a clone shares hands them over
+//    to the clone instead.  When reclamation is deferred, the inode
+//    is only put on the doomed stack and release returns at once;
+//    its subtree is freed later by reclaim, a batch at a time.
+// reclaim -
+//    Frees up to limit inodes from the doomed stack and returns how
+//    many it freed.  Called between commands, and by alloc before the
+//    table grows, when reclamation is deferred.
+// set_deferred -
+//    Turns deferred reclamation on or off.
+// doomed_count -
+//    Returns the number of inodes waiting to be reclaimed, not
+//    counting those below them.
+// path -
+//    Returns the absolute pathname of an inode, found by following
+//    parents up to the root, which is the empty string.
+// clone -
+//    Returns a new inode sharing the contents of the given one, in
+//    constant time however large the subtree below it.  The caller
+//    enters it in a directory.  Shared contents are copied only when
+//    one of the inodes holding them is written, one level at a time:
+//    a directory clone gets entries of its own, themselves clones of
+//    the entries it shared, the first time anything looks inside it.
+// dir -
+//    Returns the directory held by an inode, first giving a clone its
+//    own entries.  Every reader of a directory's entries goes through
+//    here, so it never sees inodes that belong to another directory.
+//    Throws a file_error for a plain file.
+// prepare_write -
+//    Called before the entries of a directory change.  Gives every
+//    clone of it, and of each directory above it, its own entries,
+//    from the root down, so the change is seen only through the
+//    directory written.  Free while no directory clone is left
+//    sharing entries, which sharing counts.
+// writable -
+//    Returns the plain file held by an inode, ready to be written:
+//    contents still shared with a clone are first copied, which only
+//    takes another reference to the same block.
+// file_paths -
+//    Appends the absolute pathname of every inode holding the file
+//    which is still entered in its directory, through every clone of
+//    the directories above it, so a file seen through a copied tree
+//    is found at each of its names.  Costs one step per directory
+//    above each name, never a walk of the tree.
+// restore -
+//    Makes a new inode with the given number, as when loading an
+//    image.  Free numbers are not tracked until finish_restore.
+// finish_restore -
+//    Puts every unused number below the highest restored on the free
+//    list.  Numbers above it are given out as the table grows, in the
+//    order the free list would give them, so the table never holds
+//    inodes for numbers nothing uses.
+// clear -
+//    Frees every inode at once.
+// next_inode_nr -
+//    Returns the number the table will allocate when it next grows.
+// MAX_INODES -
+//    The most inodes the table can hold, and so the highest number.
+// live -
+//    Returns the number of inodes in use, including any released but
+//    not yet reclaimed.
+// dirent_count -
+//    Returns the number of entries, dot and dotdot included, in every
+//    directory which owns its entries, visiting every inode.
+// shared_dirs -
+//    Returns the number of directory clones still sharing entries.
+// set_concurrent -
+//    Turns on locking of alloc, clone, release and reclaim, needed
+//    once sessions make and remove inodes at once.  The rest must be
+//    called with the filesystem's tree lock held exclusive, or by
+//    commands which cannot make clones share entries or unshare them.
+
+class inode_table {
+   private:
+      static constexpr size_t CHUNK_BITS = 12;
+      static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+      static constexpr size_t MAX_CHUNKS = size_t(1) << 16;
+      vector<vector<inode>> chunks;
+      size_t count {0};
+      vector<size_t> free_list;
+      vector<size_t> doomed;
+      bool deferred {false};
+      size_t sharing {0};
+      mutex lock;
+      bool concurrent {false};
+      inode& grow();
+      inode& slot();
+      size_t free_doomed (size_t limit);
+      void materialize (inode& node);
+      void hand_down (directory& dir);
+   public:
+      static constexpr size_t RECLAIM_BATCH = 4096;
+      static constexpr size_t MAX_INODES = CHUNK_SIZE * MAX_CHUNKS;
+      inode_table() {chunks.reserve (MAX_CHUNKS);}
+      inode_table (const inode_table&) = delete;
+      inode_table& operator= (const inode_table&) = delete;
+      inode& operator[] (size_t nr) {
+         size_t index = nr - 1;
+         return chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)];
+      }
+      inode_ptr alloc (file_type type);
+      void release (size_t nr);
+      size_t reclaim (size_t limit);
+      void set_deferred (bool defer) {deferred = defer;}
+      size_t doomed_count() const {return doomed.size();}
+      string path (size_t nr);
+      inode_ptr clone (inode& node);
+      directory& dir (inode& node);
+      void prepare_write (inode& node);
+      plain_file& writable (inode& node);
+      void file_paths (const plain_file& file, vector<string>& paths);
+      inode_ptr restore (size_t nr, file_type type);
+      void finish_restore();
+      void clear();
+      size_t next_inode_nr() const {return count + 1;}
+      size_t live() const {return count - free_list.size();}
+      size_t dirent_count() const;
+      size_t shared_dirs() const {return sharing;}
+      void set_concurrent (bool on) {concurrent = on;}
+};
+
+// file_system -
+//    What every session working on one tree shares:  the root (/),
+//    the inode table, the dentry cache, the arena holding file
+//    contents, the store sharing them between files of the same
+//    contents, and any journal.
+// resetRoot -
+//    Installs a new tree, dropping everything cached about the old.
+// set_concurrent -
+//    Turns on the locking needed while sessions on several threads
+//    share the filesystem:  of the inode table, the arena and the
+//    blob store, and of
+//    the entries of each directory against other writers.  The
+//    dentry cache is emptied and left unused until it is turned off,
+//    when everything retired is freed.
+// tree_lock -
+//    Held around each command while the filesystem is concurrent:
+//    shared by those which take the locks of the directories they
+//    use, and exclusive by all others.
+// hold_exclusive, tree_shared -
+//    Whether the tree lock is held exclusive, as set by whoever holds
+//    it, and whether, the filesystem being concurrent, it is not, so
+//    commands on other threads may be reading whatever is changed.
+// epochs, retire -
+//    What is unlinked from the tree while it is shared is retired
+//    here, to be freed once no command still reading can see it.
+//    Retire frees it at once when the tree is not shared.
+// changed, changes -
+//    Counts the commands run holding the tree lock exclusive, and
+//    the directories removed, after which the other sessions look
+//    for their cwd again.
+// getJournal, set_journal -
+//    The journal every change is recorded in, or nullptr.  Set by
+//    the journal itself, for as long as it lives.
+
+class file_system {
+   private:
+      // Declared first so they outlive every file holding a block.
+      file_arena arena;
+      blob_store blobs {arena};
+      inode_table table;
+      // Declared after both, since what it frees is in them.
+      epoch_domain epochs_;
+      inode_ptr root {nullptr};
+      dentry_cache dcache;
+      shared_mutex tree_lock_;
+      atomic<uint64_t> changes_ {0};
+      journal* journal_ {nullptr};
+      bool concurrent_ {false};
+      bool exclusive_ {false};
+   public:
+      file_system (const file_system&) = delete;
+      file_system& operator= (const file_system&) = delete;
+      file_system();
+      ~file_system() {blobs.close();}
+      inode_ptr getRoot(){return root;}
+      inode_table& getTable(){return table;}
+      dentry_cache& getDcache(){return dcache;}
+      file_arena& getArena(){return arena;}
+      blob_store& getBlobs(){return blobs;}
+      void resetRoot(inode_ptr newRoot);
+      bool concurrent() const {return concurrent_;}
+      void set_concurrent (bool on);
+      shared_mutex& tree_lock() {return tree_lock_;}
+      void hold_exclusive (bool held) {exclusive_ = held;}
+      bool tree_shared() const {return concurrent_ and not exclusive_;}
+      epoch_domain& epochs() {return epochs_;}
+      void retire (function<void()> free);
+      void changed() {++changes_;}
+      uint64_t changes() const {return changes_;}
+      journal* getJournal(){return journal_;}
+      void set_journal (journal* log) {journal_ = log;}
+};
+
+// inode_state -
+//    A small convenient class to maintain the state of the simulated
+//    process, of which there is one per session:  the current
+//    directory (.), the prompt, and the stream its commands print
+//    to.  The filesystem is shared with any other sessions, or made
+//    for this one alone by the default ctor.  The root and the parts
+//    of the filesystem are reached through here as well.
+// resetRoot -
+//    Installs a new tree and makes it the cwd.
+// follow_changes -
+//    Called once a command holds the tree lock.  If a command has
+//    since run holding it exclusive, or removed a directory, finds
+//    the cwd again by its pathname, or if that is gone, makes the
+//    root the cwd.
+// archive, set_archive -
+//    The stream export - writes an archive to, which must carry
+//    nothing else, so none unless set, as yshell -e does for its own
+//    session when it sends the transcript elsewhere.
+
+class inode_state {
+   friend ostream& operator<< (ostream& out, const inode_state&);
+   private:
+      unique_ptr<file_system> own_fs;
+      file_system& fs;
+      inode_ptr cwd {nullptr};
+      string prompt_ {"% "};
+      wordvec cwdPath {};
+      ostream* out_ {&cout};
+      ostream* archive_ {nullptr};
+      uint64_t changes_seen {0};
+   public:
+      inode_state (const inode_state&) = delete; // copy ctor
+      inode_state& operator= (const inode_state&) = delete; // op=
+      inode_state();
+      inode_state (file_system& shared, ostream& out);
+      file_system& getFileSystem(){return fs;}
+      inode_ptr getRoot(){return fs.getRoot();}
+      inode_ptr getCwd(){return cwd;}
+      inode_table& getTable(){return fs.getTable();}
+      const string& prompt() const;
+      void changePrompt(const string);
+      void changeCwd(inode_ptr ptr){cwd = ptr;}
+      void resetRoot(inode_ptr newRoot);
+      void follow_changes();
+      wordvec& getCwdPath(){return cwdPath;}
+      dentry_cache& getDcache(){return fs.getDcache();}
+      file_arena& getArena(){return fs.getArena();}
+      ostream& out(){return *out_;}
+      ostream* archive(){return archive_;}
+      void set_archive(ostream* archive){archive_ = archive;}
+};
+
+
 
 // class base_file -
 // Just a base class at which an inode can point.  No data or
@@ -99,10 +569,11 @@ class base_file {
       base_file (const base_file&) = delete;
       base_file& operator= (const base_file&) = delete;
       virtual size_t size() const = 0;
-      virtual const wordvec& readfile() const;
-      virtual void writefile (const wordvec& newdata);
+      virtual file_words readfile() const;
+      virtual void writefile (const wordview_range& newdata);
+      virtual void writefile (const file_words& newdata);
       //returns dirents map of base file
-      virtual map<string,inode_ptr>& getdirents(){throw file_error("is a " + error_file_type());}
+      virtual dirent_map& getdirents(){throw file_error("is a " + error_file_type());}
       virtual void remove (const string& filename);
       virtual inode_ptr mkdir (const string& dirname);
       virtual inode_ptr mkfile (const string& filename);
@@ -110,51 +581,153 @@ class base_file {
 };
 
 // class plain_file -
-// Used to hold data.
+// Used to hold data.  The words are stored back to back in one block
+// from the filesystem's arena, each followed by a space, after the
+// number of words and an index of the offset at which each word
+// starts, plus one for the end of the last word's space.  Blocks are
+// interned in the filesystem's blob store and never changed, so files
+// of the same contents share one.  Everything about the contents is
+// read from the block, so a reader on another thread sees either the
+// old contents or the new, whole.
+// The inodes holding a file are recorded in it, the first as holder
+// and any clones after, and the files holding a block are chained
+// through it, so a block found in the word index leads back to the
+// pathnames of the files holding it.
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
+//    A new file is empty and holds no block.
+// size_t ctor -
+//    A new empty file held by the given inode.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
+//    Returns a view of the words in the file, without copying them.
 // writefile -
-//    Replaces the contents of a file with new contents.
+//    Replaces the contents of a file with new contents, passing the
+//    change in size up to the directories which contain the file.
+//    The new contents may be given as views of words, such as those
+//    of a command line, or as a view of words already laid out as in
+//    a file.  Either way the block of another file of the same words
+//    is shared, and otherwise the words are copied straight into a
+//    new block.
+// replace -
+//    Publishes an interned block, accounts for its size and releases
+//    the old one, which the last file holding it retires through the
+//    filesystem.
+// slot -
+//    Returns the slot of the file's block in the word index, or 0 if
+//    the file is empty.
+// drop_holder -
+//    Forgets an inode which no longer holds the file.
+// setOwner -
+//    Records the directory holding this file and the filesystem whose
+//    blob store its words are kept in.  Set by mkfile.
 
 class plain_file: public base_file {
+   friend class blob_store;
+   friend class inode_table;
    private:
-      wordvec data;
+      atomic<char*> block {nullptr};
+      directory* owner {nullptr};
+      file_system* fs {nullptr};
+      size_t holder {0};
+      vector<size_t> clones;
+      plain_file* prev_sharer {nullptr};
+      plain_file* next_sharer {nullptr};
+      void replace (char* newBlock);
+      void drop_holder (size_t nr);
       virtual const string& error_file_type() const override {
          static const string result = "plain file";
          return result;
       }
    public:
+      plain_file() = default;
+      explicit plain_file (size_t nr): holder (nr) {}
+      virtual ~plain_file() override;
       virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
+      virtual file_words readfile() const override;
+      virtual void writefile (const wordview_range& newdata) override;
+      virtual void writefile (const file_words& newdata) override;
       virtual string fileType(){return "file";}
-
+      uint32_t slot() const;
+      void setOwner(directory* dir, file_system* shared){
+         owner = dir;
+         fs = shared;
+      }
 };
 
 // class directory -
-// Used to map filenames onto inode pointers.
+// Used to map filenames onto inode numbers.
 // default ctor -
 //    Creates a new map with keys "." and "..".
 // remove -
-//    Removes the file or subdirectory from the current inode.
-//    Throws a file_error if this is not a directory, the file
-//    does not exist, or the subdirectory is not empty.
-//    Here empty means the only entries are dot (.) and dotdot (..).
+//    Removes the file or subdirectory from the current inode and
+//    releases it, and everything under it, from the inode table,
+//    once no reader can still see it.  A subdirectory removed while
+//    the tree is shared is marked unlinked, so that a session still
+//    in it makes nothing more there.  Throws a file_error for dot,
+//    dotdot or an empty name, which are never removed.
 // mkdir -
 //    Creates a new directory under the current directory and 
 //    immediately adds the directories dot (.) and dotdot (..) to it.
 //    Note that the parent (..) of / is / itself.  It is an error
-//    if the entry already exists.
+//    if the entry already exists, or this directory is unlinked.
 // mkfile -
 //    Create a new empty text file with the given name.  Error if
-//    a dirent with that name exists.
+//    a dirent with that name exists, or this directory is unlinked.
+// bytes -
+//    Returns the total size of all plain files in the subtree rooted
+//    here, maintained incrementally so no file data is rescanned.
+// adjustBytes -
+//    Adds delta to the subtree size of this directory and of each
+//    directory above it, following dotdot up to the root.  Sessions
+//    writing files in different directories may both pass through
+//    the same directories above, so the sizes are atomic, and dotdot
+//    is read from where set_dots keeps it, not from the entries.
+// recountBytes -
+//    Recomputes the subtree size from the sizes of the entries, which
+//    must already be right.  Used when building a tree bottom up.
+// attach -
+//    Attaches the filesystem whose inode table holds the entries of
+//    this directory, whose dentry cache is invalidated when it
+//    changes and whose arena holds the files made here.  Directories
+//    made by mkdir inherit it.
+// link -
+//    Enters an inode made elsewhere, such as a clone, under the given
+//    name.  Throws a file_error if the entry already exists.
+// set_dots -
+//    Enters dot and dotdot, replacing any there already.
+// writing -
+//    Locks the entries against other writers while the filesystem is
+//    concurrent, and otherwise holds nothing.  The plain files entered
+//    here go with them, since a file is written through the directory
+//    it is in.  Readers take no lock:  while the tree lock is held
+//    shared, the members above publish each change to the entries as
+//    a new version and retire the old, as they do the inodes they
+//    remove, so a reader sees the entries either before a change or
+//    after it.  A command locks a directory only after any directory
+//    above it which it locks, and takes none while holding an inode
+//    table or arena lock, so the locks cannot deadlock.  Not taken by
+//    the members above, whose callers hold it.
+// lookup -
+//    Returns the inode number of an entry, or 0.
+// unlinked -
+//    Whether this directory has been removed from its parent, which
+//    may only be asked holding its lock.
+//
+// The inode named by dot owns the entries.  Any other inode holding
+// the same directory is a clone of it, listed in clones until it
+// gets entries of its own.
 
 class directory: public base_file {
+   friend class inode_table;
    private:
-      // Must be a map, not unordered_map, so printing is lexicographic
-      map<string,inode_ptr> dirents;
+      // Must be ordered, not unordered_map, so printing is lexicographic
+      dirent_map dirents;
+      file_system* fs {nullptr};
+      atomic<size_t> bytes_ {0};
+      size_t dotdot {0};
+      vector<size_t> clones;
+      bool unlinked_ {false};
+      mutable mutex entries_lock;
+      epoch_domain* readers() const;
       virtual const string& error_file_type() const override {
          static const string result = "directory";
          return result;
@@ -162,10 +735,23 @@ class directory: public base_file {
    public:
       virtual size_t size() const override;
       virtual void remove (const string& filename) override;
-      virtual map<string,inode_ptr>& getdirents() override {return dirents;}
+      virtual dirent_map& getdirents() override {return dirents;}
       virtual inode_ptr mkdir (const string& dirname) override;
       virtual inode_ptr mkfile (const string& filename) override;
       virtual string fileType(){return "directory";}
+      size_t bytes() const {return bytes_.load (memory_order_relaxed);}
+      void adjustBytes(ptrdiff_t delta);
+      void recountBytes();
+      void link (const string& name, inode_ptr node);
+      void set_dots (size_t self, size_t parent);
+      void attach(file_system* shared){fs = shared;}
+      unique_lock<mutex> writing() const {
+         return lock_if (entries_lock, fs->concurrent());
+      }
+      size_t lookup (string_view name) const {
+         return dirents.lookup (name);
+      }
+      bool unlinked() const {return unlinked_;}
 };
 
 #endif
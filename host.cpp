@@ -0,0 +1,564 @@
+// $Id: host.cpp,v 1.1 2026-10-18 09:00:00-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "host.h"
+#include "util.h"
+
+host_error::host_error (const string& what): runtime_error (what) {
+}
+
+namespace {
+
+// WHITE_SPACE -
+//    Where the contents of a host file are split into words.  A line
+//    given to make is split at blanks, but a file also has newlines.
+
+constexpr char WHITE_SPACE[] = " \t\n\v\f\r";
+
+// FILE_BATCH -
+//    How many files are mapped and split at once before being written,
+//    which bounds how much of the host is mapped at any time.
+
+constexpr size_t FILE_BATCH = 256;
+
+// MAP_THRESHOLD -
+//    Files at least this big are mapped.  Smaller ones are read into a
+//    buffer kept from one file to the next, which costs less than
+//    setting up and tearing down a mapping.
+
+constexpr size_t MAP_THRESHOLD = 1 << 16;
+
+// host_entry -
+//    A directory or regular file found on the host.  A directory
+//    keeps its host path and the range of entries holding what is in
+//    it, sorted by name.  Its yshell inode is filled in as the tree is
+//    built.
+
+struct host_entry {
+   string name;
+   size_t parent;
+   bool directory;
+   string path {};
+   size_t first_child {0};
+   size_t end_child {0};
+   inode_ptr node {nullptr};
+};
+
+// found_entry -
+//    What scanning a directory yields for each entry kept.
+
+struct found_entry {
+   string name;
+   bool directory;
+   bool operator< (const found_entry& that) const {
+      return name < that.name;
+   }
+};
+
+// scan_directory -
+//    Lists the subdirectories and regular files of a host directory,
+//    sorted by name.  Returns an error message, or an empty string.
+//    Runs on any thread.
+
+string scan_directory (const string& path, vector<found_entry>& found) {
+   DIR* dir = opendir (path.c_str());
+   if (dir == nullptr) return path + ": " + strerror (errno);
+   for (;;) {
+      errno = 0;
+      struct dirent* entry = readdir (dir);
+      if (entry == nullptr) break;
+      string_view name = entry->d_name;
+      if (name == "." or name == "..") continue;
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN) {
+         struct stat status;
+         if (fstatat (dirfd (dir), entry->d_name, &status,
+                      AT_SYMLINK_NOFOLLOW) < 0) continue;
+         if (S_ISDIR (status.st_mode)) type = DT_DIR;
+         else if (S_ISREG (status.st_mode)) type = DT_REG;
+      }
+      if (type != DT_DIR and type != DT_REG) continue;
+      found.push_back ({string (name), type == DT_DIR});
+   }
+   int error = errno;
+   closedir (dir);
+   if (error != 0) return path + ": " + strerror (error);
+   sort (found.begin(), found.end());
+   return {};
+}
+
+// scan_tree -
+//    Lists the whole host tree, a level at a time, scanning every
+//    directory of a level in parallel.  The root comes first and the
+//    entries of each directory are contiguous.  Throws a host_error
+//    naming the first directory which could not be read.
+
+vector<host_entry> scan_tree (const string& hostpath) {
+   struct stat status;
+   if (stat (hostpath.c_str(), &status) < 0) {
+      throw host_error (hostpath + ": " + strerror (errno));
+   }
+   if (not S_ISDIR (status.st_mode)) {
+      throw host_error (hostpath + ": not a directory");
+   }
+   vector<host_entry> entries;
+   entries.push_back ({"", 0, true, hostpath});
+   vector<size_t> level {0};
+   while (not level.empty()) {
+      vector<vector<found_entry>> found (level.size());
+      vector<string> errors (level.size());
+      run_parallel (level.size(), [&] (size_t index) {
+         errors[index] = scan_directory (entries[level[index]].path,
+                                         found[index]);
+      });
+      for (const auto& error: errors) {
+         if (not error.empty()) throw host_error (error);
+      }
+      vector<size_t> next;
+      for (size_t index = 0; index < level.size(); ++index) {
+         size_t parent = level[index];
+         entries[parent].first_child = entries.size();
+         for (auto& child: found[index]) {
+            if (child.directory) {
+               next.push_back (entries.size());
+               string path = entries[parent].path + "/" + child.name;
+               entries.push_back ({move (child.name), parent, true,
+                                   move (path)});
+            }else {
+               entries.push_back ({move (child.name), parent, false});
+            }
+         }
+         entries[parent].end_child = entries.size();
+      }
+      level = move (next);
+   }
+   return entries;
+}
+
+// make_entry -
+//    Finds or makes the yshell inode for a host entry in the directory
+//    of its parent.
+
+inode_ptr make_entry (inode_table& table, const host_entry& parent,
+                      const host_entry& entry) {
+   try {
+      directory& dir = table.dir (*parent.node);
+      size_t nr = dir.getdirents().lookup (entry.name);
+      if (nr == 0) {
+         return entry.directory ? dir.mkdir (entry.name)
+                                : dir.mkfile (entry.name);
+      }
+      inode_ptr node = &table[nr];
+      if (entry.directory) table.dir (*node);
+                      else table.writable (*node);
+      return node;
+   }catch (file_error& error) {
+      throw host_error (parent.path + "/" + entry.name + ": "
+                        + error.what());
+   }
+}
+
+// loaded_file -
+//    A host file mapped or read and split into words, ready to be
+//    written.
+
+struct loaded_file {
+   void* base {nullptr};
+   size_t length {0};
+   vector<char> buffer;
+   wordviews words;
+   string error;
+   void unmap() {
+      if (base != nullptr) munmap (base, length);
+      base = nullptr;
+      length = 0;
+   }
+};
+
+// read_fully -
+//    Reads length bytes into the buffer, returning false on error or
+//    if the file is shorter than fstat said.
+
+bool read_fully (int fd, char* buffer, size_t length) {
+   size_t done = 0;
+   while (done < length) {
+      ssize_t count = read (fd, buffer + done, length - done);
+      if (count < 0 and errno == EINTR) continue;
+      if (count <= 0) return false;
+      done += count;
+   }
+   return true;
+}
+
+// load_file -
+//    Maps or reads a host file and splits it into words.  Runs on any
+//    thread.
+
+void load_file (const string& path, loaded_file& file) {
+   file.words.clear();
+   file.error.clear();
+   int fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      file.error = path + ": " + strerror (errno);
+      return;
+   }
+   struct stat status;
+   if (fstat (fd, &status) < 0) {
+      file.error = path + ": " + strerror (errno);
+   }else if (status.st_size > 0
+             and size_t (status.st_size) < MAP_THRESHOLD) {
+      size_t length = status.st_size;
+      file.buffer.resize (length);
+      if (not read_fully (fd, file.buffer.data(), length)) {
+         file.error = path + ": " + (errno != 0 ? strerror (errno)
+                                                : "short read");
+      }else {
+         tokenize (string_view (file.buffer.data(), length),
+                   WHITE_SPACE, file.words);
+      }
+   }else if (status.st_size > 0) {
+      void* mapped = mmap (nullptr, status.st_size, PROT_READ,
+                           MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+         file.error = path + ": " + strerror (errno);
+      }else {
+         madvise (mapped, status.st_size, MADV_SEQUENTIAL);
+         file.base = mapped;
+         file.length = status.st_size;
+         tokenize (string_view (static_cast<const char*> (mapped),
+                                file.length), WHITE_SPACE, file.words);
+      }
+   }
+   close (fd);
+}
+
+// walk_tree -
+//    Calls visit for everything below the yshell directory source,
+//    with its path relative to source, in order of name, each
+//    directory's own entries before those below them.  A directory's
+//    entries are listed before any is visited, since looking into a
+//    clone gives it entries of its own.
+
+using tree_visitor = function<void(const string& path, inode& node,
+                                   bool directory)>;
+
+void walk_tree (inode_table& table, inode& source,
+                const tree_visitor& visit) {
+   struct pending {
+      inode_ptr node;
+      string path;
+   };
+   vector<pending> stack {{&source, ""}};
+   vector<pair<string,size_t>> entries;
+   while (not stack.empty()) {
+      pending dir = move (stack.back());
+      stack.pop_back();
+      entries.clear();
+      for (const auto& entry: table.dir (*dir.node).getdirents()) {
+         if (entry.first == "." or entry.first == "..") continue;
+         entries.emplace_back (entry.first, entry.second);
+      }
+      size_t first = stack.size();
+      for (const auto& [name, nr]: entries) {
+         inode& node = table[nr];
+         bool is_dir = dynamic_cast<directory*>
+                       (node.getContents().get()) != nullptr;
+         string path = dir.path.empty() ? name : dir.path + "/" + name;
+         visit (path, node, is_dir);
+         if (is_dir) stack.push_back ({&node, move (path)});
+      }
+      reverse (stack.begin() + first, stack.end());
+   }
+}
+
+// make_host_dir -
+//    Makes a host directory, or accepts one already there.
+
+void make_host_dir (const string& path) {
+   if (mkdir (path.c_str(), 0755) == 0) return;
+   int error = errno;
+   struct stat status;
+   if (error == EEXIST and stat (path.c_str(), &status) == 0) {
+      if (S_ISDIR (status.st_mode)) return;
+      throw host_error (path + ": not a directory");
+   }
+   throw host_error (path + ": " + strerror (error));
+}
+
+// write_host_file -
+//    Writes a yshell file to the host as cat prints it, the words and
+//    the newline after them gathered into one writev.  Returns an
+//    error message, or an empty string.  Runs on any thread.
+
+string write_host_file (const string& path, const file_words& words) {
+   int fd = open (path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+   if (fd < 0) return path + ": " + strerror (errno);
+   string_view text = words.text();
+   static const char newline[] = "\n";
+   iovec pieces[2] {
+      {const_cast<char*> (text.data()), text.size()},
+      {const_cast<char*> (newline), 1},
+   };
+   iovec* next = pieces;
+   size_t left = 2;
+   string error;
+   while (left > 0) {
+      ssize_t count = writev (fd, next, left);
+      if (count < 0 and errno == EINTR) continue;
+      if (count < 0) {
+         error = path + ": " + strerror (errno);
+         break;
+      }
+      // Step past whatever was written, which may end mid-piece.
+      size_t done = count;
+      while (left > 0 and done >= next->iov_len) {
+         done -= next->iov_len;
+         ++next;
+         --left;
+      }
+      if (left > 0) {
+         next->iov_base = static_cast<char*> (next->iov_base) + done;
+         next->iov_len -= done;
+      }
+   }
+   if (close (fd) < 0 and error.empty()) {
+      error = path + ": " + strerror (errno);
+   }
+   return error;
+}
+
+// ustar_writer -
+//    Writes a POSIX ustar archive to a stream a member at a time, so
+//    nothing but one header is held in memory.  A path too long for
+//    the name and prefix fields of a header is given in a pax extended
+//    header before it.
+// member -
+//    Writes a header, then the data padded to a whole block.
+// finish -
+//    Writes the two zero blocks which end an archive.
+
+class ustar_writer {
+   private:
+      static constexpr size_t BLOCK = 512;
+      ostream& out;
+      time_t mtime;
+      void header (const string& path, char type, size_t size);
+      void pad (size_t size);
+   public:
+      ustar_writer (ostream& out_): out (out_), mtime (time (nullptr)) {}
+      void member (const string& path, char type, string_view data,
+                   string_view trailer = {});
+      void finish();
+};
+
+// set_octal -
+//    Fills a numeric header field with zero-padded octal and a NUL.
+//    A value with more digits than the field holds, as a large uid
+//    may have, is stored as 0.
+
+void set_octal (char* field, size_t width, uint64_t value) {
+   if (value >> (3 * (width - 1)) != 0) value = 0;
+   field[width - 1] = '\0';
+   for (size_t digit = width - 1; digit-- > 0; value >>= 3) {
+      field[digit] = static_cast<char> ('0' + (value & 7));
+   }
+}
+
+void ustar_writer::header (const string& path, char type, size_t size) {
+   char block[BLOCK] {};
+   // name is at 0, 100 bytes; prefix at 345, 155 bytes.
+   if (path.size() <= 100) {
+      memcpy (block, path.data(), path.size());
+   }else {
+      // A directory's own trailing slash is not a place to split.
+      size_t split = path.rfind ('/', min<size_t> (155, path.size() - 2));
+      if (split == string::npos or split == 0
+          or path.size() - split - 1 > 100
+          or path.size() - split - 1 == 0) {
+         // Does not fit:  name it in a pax header, truncated here.
+         string record = " path=" + path + "\n";
+         size_t length = record.size();
+         while (to_string (length).size() + record.size() != length) {
+            length = to_string (length).size() + record.size();
+         }
+         record = to_string (length) + record;
+         header ("PaxHeader/" + path.substr (path.size() - 80), 'x',
+                 record.size());
+         out.write (record.data(), record.size());
+         pad (record.size());
+         memcpy (block, path.data(), 100);
+      }else {
+         memcpy (block, path.data() + split + 1, path.size() - split - 1);
+         memcpy (block + 345, path.data(), split);
+      }
+   }
+   set_octal (block + 100, 8, type == '5' ? 0755 : 0644);
+   set_octal (block + 108, 8, getuid());
+   set_octal (block + 116, 8, getgid());
+   set_octal (block + 124, 12, size);
+   set_octal (block + 136, 12, mtime);
+   block[156] = type;
+   memcpy (block + 257, "ustar", 6);
+   memcpy (block + 263, "00", 2);
+   // The checksum is taken with its own field all blanks.
+   memset (block + 148, ' ', 8);
+   unsigned sum = 0;
+   for (unsigned char byte: block) sum += byte;
+   snprintf (block + 148, 8, "%06o", sum);
+   out.write (block, BLOCK);
+}
+
+void ustar_writer::pad (size_t size) {
+   static const char zeros[BLOCK] {};
+   size_t tail = size % BLOCK;
+   if (tail != 0) out.write (zeros, BLOCK - tail);
+}
+
+void ustar_writer::member (const string& path, char type,
+                           string_view data, string_view trailer) {
+   size_t size = data.size() + trailer.size();
+   header (path, type, size);
+   out.write (data.data(), data.size());
+   out.write (trailer.data(), trailer.size());
+   pad (size);
+}
+
+void ustar_writer::finish() {
+   static const char zeros[2 * BLOCK] {};
+   out.write (zeros, sizeof zeros);
+}
+
+}
+
+void import_tree (inode_state& state, const string& hostpath,
+                  const function<inode&()>& target) {
+   vector<host_entry> entries = scan_tree (hostpath);
+   inode_table& table = state.getTable();
+   entries[0].node = &target();
+
+   // Make every entry, each directory's own before those below.
+   vector<size_t> files;
+   vector<size_t> stack {0};
+   while (not stack.empty()) {
+      const host_entry& parent = entries[stack.back()];
+      stack.pop_back();
+      for (size_t child = parent.first_child; child < parent.end_child;
+           ++child) {
+         entries[child].node = make_entry (table, parent, entries[child]);
+         if (not entries[child].directory) files.push_back (child);
+      }
+      for (size_t child = parent.end_child; child > parent.first_child;
+           --child) {
+         if (entries[child - 1].directory) stack.push_back (child - 1);
+      }
+   }
+   TRACEF ('h', "entries = {}, files = {}", entries.size(),
+           files.size());
+
+   // Fill in the files, a batch mapped and split in parallel at a
+   // time, then written here.
+   vector<loaded_file> loaded (min (FILE_BATCH, files.size()));
+   string first_error;
+   size_t errors = 0;
+   for (size_t start = 0; start < files.size(); start += FILE_BATCH) {
+      size_t count = min (FILE_BATCH, files.size() - start);
+      run_parallel (count, [&] (size_t index) {
+         const host_entry& file = entries[files[start + index]];
+         load_file (entries[file.parent].path + "/" + file.name,
+                    loaded[index]);
+      });
+      for (size_t index = 0; index < count; ++index) {
+         loaded_file& file = loaded[index];
+         const host_entry& entry = entries[files[start + index]];
+         try {
+            if (file.error.empty()) {
+               table.writable (*entry.node).writefile (
+                     wordview_range (file.words.cbegin(),
+                                     file.words.cend()));
+            }
+         }catch (file_error& error) {
+            file.error = entries[entry.parent].path + "/" + entry.name
+                       + ": " + error.what();
+         }
+         file.unmap();
+         if (not file.error.empty() and errors++ == 0) {
+            first_error = file.error;
+         }
+      }
+   }
+   if (errors == 1) throw host_error (first_error);
+   if (errors > 1) {
+      throw host_error (first_error + ", and " + to_string (errors - 1)
+                        + " more files not imported");
+   }
+}
+
+void export_tree (inode_state& state, inode& source,
+                  const string& hostdir) {
+   inode_table& table = state.getTable();
+   make_host_dir (hostdir);
+
+   // Directories are made here, files only listed.
+   struct pending_file {
+      string path;
+      file_words words;
+   };
+   vector<pending_file> files;
+   walk_tree (table, source, [&] (const string& path, inode& node,
+                                  bool directory) {
+      string hostpath = hostdir + "/" + path;
+      if (directory) make_host_dir (hostpath);
+      else files.push_back ({move (hostpath),
+                             node.getContents()->readfile()});
+   });
+   TRACEF ('h', "files = {}", files.size());
+
+   // Nothing in yshell changes while the files are written, so their
+   // words can be read from every thread.
+   vector<string> errors (files.size());
+   run_parallel (files.size(), [&] (size_t index) {
+      errors[index] = write_host_file (files[index].path,
+                                       files[index].words);
+   });
+   size_t failed = 0;
+   const string* first_error = nullptr;
+   for (const auto& error: errors) {
+      if (error.empty()) continue;
+      if (failed++ == 0) first_error = &error;
+   }
+   if (failed == 1) throw host_error (*first_error);
+   if (failed > 1) {
+      throw host_error (*first_error + ", and " + to_string (failed - 1)
+                        + " more files not exported");
+   }
+}
+
+void export_tar (inode_state& state, inode& source, ostream& out) {
+   ustar_writer archive (out);
+   walk_tree (state.getTable(), source,
+              [&] (const string& path, inode& node, bool directory) {
+      if (directory) {
+         archive.member (path + "/", '5', {});
+      }else {
+         archive.member (path, '0',
+                         node.getContents()->readfile().text(), "\n");
+      }
+   });
+   archive.finish();
+}
@@ -0,0 +1,62 @@
+// $Id: host.h,v 1.1 2026-10-18 09:00:00-07 - - $
+
+// host -
+//    Moves trees between the host filesystem and yshell, so data sets
+//    on the host need not be turned into mkdir and make commands.
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+
+// host_error -
+//    Thrown when a host file or directory cannot be read, or an entry
+//    cannot be made in yshell.
+
+class host_error: public runtime_error {
+   public:
+      explicit host_error (const string& what);
+};
+
+// import_tree -
+//    Copies the host directory hostpath, which is only read, into the
+//    yshell directory returned by target, which is called only once
+//    the host tree has been scanned, so nothing is made in yshell if
+//    the host tree cannot be read.  Subdirectories are made with mkdir
+//    and regular files with mkfile, in order of name, a directory's
+//    own entries before those below them, then filled by writefile
+//    with their contents split into words at white space, so the tree
+//    is the one the same mkdir and make commands would build.  An
+//    entry already there is merged into if both are directories and
+//    overwritten if both are files.  Symbolic links and special files
+//    are skipped.  Host directories are scanned, and files mapped and
+//    split, on all cores; the tree itself is built on the caller's
+//    thread.
+
+void import_tree (inode_state& state, const string& hostpath,
+                  const function<inode&()>& target);
+
+// export_tree -
+//    Writes everything below the yshell directory source into the
+//    host directory hostdir, which is made if it is not there.  Each
+//    file holds what cat prints for it, and files already there are
+//    overwritten.  Directories are made on the caller's thread, then
+//    the files are written from all cores.
+// export_tar -
+//    Writes everything below the yshell directory source to out as a
+//    ustar archive, with paths relative to source, streamed a member
+//    at a time.  Since out is normally cout, the archive follows
+//    whatever the transcript has already printed.
+
+void export_tree (inode_state& state, inode& source,
+                  const string& hostdir);
+void export_tar (inode_state& state, inode& source, ostream& out);
+
+#endif
+
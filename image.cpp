@@ -0,0 +1,375 @@
+// $Id: image.cpp,v 1.1 2026-10-18 06:40:00-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "image.h"
+
+namespace {
+
+constexpr char IMAGE_MAGIC[8] {'Y', 'S', 'H', 'I', 'M', 'G', '0', '2'};
+constexpr uint32_t PLAIN_RECORD {0};
+constexpr uint32_t DIRECTORY_RECORD {1};
+
+struct image_header {
+   char magic[8];
+   uint64_t next_inode_nr;
+   uint64_t inode_count;
+   uint64_t string_bytes;
+   uint64_t payload_bytes;
+};
+
+struct image_inode {
+   uint64_t inode_nr;
+   uint64_t parent_nr;
+   uint64_t payload_offset;
+   uint32_t name_offset;
+   uint32_t name_length;
+   uint32_t type;
+   uint32_t words;
+};
+
+size_t align (size_t offset, size_t boundary) {
+   return (offset + boundary - 1) / boundary * boundary;
+}
+
+// mapped_file -
+//    A host file mapped read-only for as long as this object lives.
+
+class mapped_file {
+   private:
+      int fd {-1};
+      const char* base {nullptr};
+      size_t length {0};
+   public:
+      explicit mapped_file (const string& filename);
+      ~mapped_file();
+      mapped_file (const mapped_file&) = delete;
+      mapped_file& operator= (const mapped_file&) = delete;
+      const char* data() const {return base;}
+      size_t size() const {return length;}
+};
+
+mapped_file::mapped_file (const string& filename) {
+   fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) throw image_error (filename + ": " + strerror (errno));
+   struct stat status;
+   if (fstat (fd, &status) < 0) {
+      int error = errno;
+      close (fd);
+      throw image_error (filename + ": " + strerror (error));
+   }
+   length = status.st_size;
+   if (length == 0) return;
+   void* mapped = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (mapped == MAP_FAILED) {
+      int error = errno;
+      close (fd);
+      throw image_error (filename + ": " + strerror (error));
+   }
+   base = static_cast<const char*> (mapped);
+}
+
+mapped_file::~mapped_file() {
+   if (base != nullptr) {
+      munmap (const_cast<char*> (base), length);
+   }
+   if (fd >= 0) close (fd);
+}
+
+// name_key -
+//    Identifies a dirent while checking an image for duplicates.
+
+struct name_key {
+   uint64_t parent_nr;
+   string_view name;
+   bool operator== (const name_key& that) const {
+      return parent_nr == that.parent_nr and name == that.name;
+   }
+};
+
+struct name_key_hash {
+   size_t operator() (const name_key& key) const {
+      return hash<string_view>{} (key.name) ^ (key.parent_nr * 31);
+   }
+};
+
+}
+
+image_error::image_error (const string& what): runtime_error (what) {
+}
+
+void save_image (inode_state& state, const string& filename) {
+   inode_table& table = state.getTable();
+   vector<image_inode> records;
+   vector<inode_ptr> files;
+   string strings;
+   unordered_map<string,uint32_t> string_offsets;
+   uint64_t payload_bytes = 0;
+
+   // Walk the tree depth first with an explicit stack, so every
+   // parent is recorded before any of its children.
+   struct pending {
+      inode_ptr node;
+      size_t parent_nr;
+      string_view name;
+   };
+   vector<pending> stack {{state.getRoot(),
+                           state.getRoot()->get_inode_nr(), {}}};
+   while (not stack.empty()) {
+      pending next = stack.back();
+      stack.pop_back();
+      image_inode record {};
+      record.inode_nr = next.node->get_inode_nr();
+      record.parent_nr = next.parent_nr;
+      auto interned = string_offsets.find (string (next.name));
+      if (interned == string_offsets.end()) {
+         if (strings.size() + next.name.size() > UINT32_MAX) {
+            throw image_error (filename + ": too many names");
+         }
+         interned = string_offsets.emplace (next.name,
+                                            strings.size()).first;
+         strings.append (next.name);
+      }
+      record.name_offset = interned->second;
+      record.name_length = next.name.size();
+      auto& contents = next.node->getContents();
+      if (contents->fileType() == "directory") {
+         record.type = DIRECTORY_RECORD;
+         for (const auto& entry: table.dir (*next.node).getdirents()) {
+            if (entry.first == "." or entry.first == "..") continue;
+            stack.push_back ({&table[entry.second],
+                              record.inode_nr, entry.first});
+         }
+      }else {
+         record.type = PLAIN_RECORD;
+         file_words data = contents->readfile();
+         record.words = data.size();
+         if (not data.empty()) {
+            record.payload_offset = payload_bytes;
+            payload_bytes += align ((data.size() + 1) * sizeof (uint32_t)
+                                    + data.text().size(), 4);
+            files.push_back (next.node);
+         }
+      }
+      records.push_back (record);
+   }
+
+   image_header header {};
+   memcpy (header.magic, IMAGE_MAGIC, sizeof header.magic);
+   header.next_inode_nr = table.next_inode_nr();
+   header.inode_count = records.size();
+   header.string_bytes = strings.size();
+   header.payload_bytes = payload_bytes;
+
+   static char buffer[1 << 16];
+   ofstream out;
+   out.rdbuf()->pubsetbuf (buffer, sizeof buffer);
+   out.open (filename, ios::binary | ios::trunc);
+   if (not out) throw image_error (filename + ": " + strerror (errno));
+   const char padding[8] {};
+   out.write (reinterpret_cast<const char*> (&header), sizeof header);
+   out.write (reinterpret_cast<const char*> (records.data()),
+              records.size() * sizeof (image_inode));
+   out.write (strings.data(), strings.size());
+   out.write (padding, align (strings.size(), 8) - strings.size());
+   for (inode_ptr file: files) {
+      file_words data = file->getContents()->readfile();
+      size_t bytes = (data.size() + 1) * sizeof (uint32_t);
+      out.write (reinterpret_cast<const char*> (data.index()), bytes);
+      out.write (data.text().data(), data.text().size());
+      bytes += data.text().size();
+      out.write (padding, align (bytes, 4) - bytes);
+   }
+   out.close();
+   if (not out) throw image_error (filename + ": write failed");
+   TRACEF ('m', "saved {} inodes, {} string bytes, {} payload bytes",
+           records.size(), strings.size(), payload_bytes);
+}
+
+void load_image (inode_state& state, const string& filename) {
+   mapped_file image (filename);
+   auto malformed = [&filename] (const string& why) {
+      return image_error (filename + ": not a valid image: " + why);
+   };
+   image_header header;
+   if (image.size() < sizeof header) throw malformed ("too short");
+   memcpy (&header, image.data(), sizeof header);
+   if (memcmp (header.magic, IMAGE_MAGIC, sizeof header.magic) != 0) {
+      throw malformed ("bad magic number");
+   }
+   size_t records_at = sizeof header;
+   if (header.inode_count == 0
+       or header.inode_count > (image.size() - records_at)
+                               / sizeof (image_inode)) {
+      throw malformed ("bad inode count");
+   }
+   // Bounded by what the table holds, so neither the check below nor
+   // the restore can run out of room once the old tree is gone.
+   if (header.next_inode_nr <= header.inode_count
+       or header.next_inode_nr > inode_table::MAX_INODES + 1) {
+      throw malformed ("bad next inode number");
+   }
+   size_t strings_at = records_at
+                     + header.inode_count * sizeof (image_inode);
+   if (header.string_bytes > image.size() - strings_at) {
+      throw malformed ("bad string table size");
+   }
+   size_t payload_at = align (strings_at + header.string_bytes, 8);
+   if (payload_at > image.size()
+       or header.payload_bytes > image.size() - payload_at) {
+      throw malformed ("bad payload size");
+   }
+   auto records = reinterpret_cast<const image_inode*>
+                  (image.data() + records_at);
+   const char* strings = image.data() + strings_at;
+   const char* payloads = image.data() + payload_at;
+   auto name_of = [strings] (const image_inode& record) {
+      return string_view (strings + record.name_offset,
+                          record.name_length);
+   };
+   auto words_of = [payloads] (const image_inode& record) {
+      auto index = reinterpret_cast<const uint32_t*>
+                   (payloads + record.payload_offset);
+      return file_words (index, reinterpret_cast<const char*>
+                                (index + record.words + 1),
+                         record.words);
+   };
+
+   // Check everything before touching the current tree.  The types
+   // are kept by number up to the highest in use, not up to the next
+   // number, which may be far above it.
+   uint64_t highest_nr = 0;
+   for (size_t index = 0; index < header.inode_count; ++index) {
+      uint64_t nr = records[index].inode_nr;
+      if (nr == 0 or nr >= header.next_inode_nr) {
+         throw malformed ("bad inode number");
+      }
+      highest_nr = max (highest_nr, nr);
+   }
+   constexpr uint8_t NO_RECORD = UINT8_MAX;
+   vector<uint8_t> types (highest_nr + 1, NO_RECORD);
+   unordered_set<name_key,name_key_hash> names;
+   names.reserve (header.inode_count);
+   for (size_t index = 0; index < header.inode_count; ++index) {
+      const image_inode& record = records[index];
+      if (types[record.inode_nr] != NO_RECORD) {
+         throw malformed ("bad inode number");
+      }
+      if (record.type != PLAIN_RECORD and record.type != DIRECTORY_RECORD) {
+         throw malformed ("bad inode type");
+      }
+      if (uint64_t (record.name_offset) + record.name_length
+          > header.string_bytes) {
+         throw malformed ("bad name");
+      }
+      string_view name = name_of (record);
+      if (index == 0) {
+         if (record.type != DIRECTORY_RECORD
+             or record.parent_nr != record.inode_nr or not name.empty()) {
+            throw malformed ("bad root");
+         }
+      }else {
+         if (record.parent_nr > highest_nr
+             or types[record.parent_nr] != DIRECTORY_RECORD) {
+            throw malformed ("bad parent");
+         }
+         if (name.empty() or name == "." or name == ".."
+             or name.find ('/') != string_view::npos
+             or not names.insert ({record.parent_nr, name}).second) {
+            throw malformed ("bad name");
+         }
+      }
+      if (record.type == PLAIN_RECORD and record.words > 0) {
+         uint64_t index_bytes = (uint64_t (record.words) + 1)
+                              * sizeof (uint32_t);
+         if (record.payload_offset % 4 != 0
+             or record.payload_offset > header.payload_bytes
+             or index_bytes > header.payload_bytes
+                              - record.payload_offset) {
+            throw malformed ("bad payload");
+         }
+         auto offsets = reinterpret_cast<const uint32_t*>
+                        (payloads + record.payload_offset);
+         if (offsets[0] != 0) throw malformed ("bad payload");
+         for (size_t word = 0; word < record.words; ++word) {
+            if (offsets[word + 1] <= offsets[word]) {
+               throw malformed ("bad payload");
+            }
+         }
+         if (offsets[record.words] > header.payload_bytes
+                                   - record.payload_offset - index_bytes) {
+            throw malformed ("bad payload");
+         }
+         // Every word must end in the space cat prints after it.
+         auto text = reinterpret_cast<const char*> (offsets
+                                                    + record.words + 1);
+         for (size_t word = 1; word <= record.words; ++word) {
+            if (text[offsets[word] - 1] != ' ') {
+               throw malformed ("bad payload");
+            }
+         }
+      }
+      types[record.inode_nr] = static_cast<uint8_t> (record.type);
+   }
+
+   // Build the new tree.  Files are filled in before being given an
+   // owner, and subtree sizes are summed afterwards, children first,
+   // so nothing is propagated up the tree once per file.
+   inode_table& table = state.getTable();
+   table.clear();
+   for (size_t index = 0; index < header.inode_count; ++index) {
+      const image_inode& record = records[index];
+      size_t nr = record.inode_nr;
+      inode_ptr node = table.restore (nr, record.type == DIRECTORY_RECORD
+                                          ? file_type::DIRECTORY_TYPE
+                                          : file_type::PLAIN_TYPE);
+      auto& contents = node->getContents();
+      if (index == 0) {
+         dynamic_cast<directory&> (*contents).set_dots (nr, nr);
+         node->link (nr, "");
+         state.resetRoot (node);
+         continue;
+      }
+      inode& parent = table[record.parent_nr];
+      auto parentDir = dynamic_cast<directory*>
+                       (parent.getContents().get());
+      string name {name_of (record)};
+      node->link (record.parent_nr, name);
+      parentDir->getdirents().insert ({move (name), nr});
+      if (record.type == DIRECTORY_RECORD) {
+         auto& dir = dynamic_cast<directory&> (*contents);
+         dir.set_dots (nr, record.parent_nr);
+         dir.attach (&state.getFileSystem());
+      }else {
+         auto file = dynamic_cast<plain_file*> (contents.get());
+         file->setOwner (nullptr, &state.getFileSystem());
+         if (record.words > 0) file->writefile (words_of (record));
+         file->setOwner (parentDir, &state.getFileSystem());
+      }
+   }
+   table.finish_restore();
+   for (size_t index = header.inode_count; index-- > 0;) {
+      const image_inode& record = records[index];
+      if (record.type == DIRECTORY_RECORD) {
+         dynamic_cast<directory&> (*table[record.inode_nr].getContents())
+            .recountBytes();
+      }
+   }
+   TRACEF ('m', "loaded {} inodes, next = {}", header.inode_count,
+           header.next_inode_nr);
+}
+
@@ -0,0 +1,50 @@
+// $Id: image.h,v 1.1 2026-10-18 06:40:00-07 - - $
+
+// image -
+//    Saves the whole filesystem to a compact binary image on the host
+//    and loads it back, so a fixture tree need not be rebuilt from
+//    mkdir and make commands on every run.
+//
+//    An image is, in native byte order:
+//       the header, with the inode count and next_inode_nr;
+//       one fixed-size record per inode, parents before children and
+//          the root first, giving its number, type, parent, name and
+//          the offset of its payload;
+//       the string table, holding each distinct name once;
+//       the payloads, one per nonempty plain file, each laid out
+//          exactly as a plain file's block:  the offset of each word
+//          plus one past the end, then the words back to back, each
+//          followed by a space.
+//    Sections start on 8-byte boundaries and payloads on 4-byte
+//    boundaries, so a mapped image can be read in place.
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+#include "file_sys.h"
+
+// image_error -
+//    Thrown when an image cannot be written, read, or is malformed.
+
+class image_error: public runtime_error {
+   public:
+      explicit image_error (const string& what);
+};
+
+// save_image -
+//    Writes the tree rooted at / to the named host file.
+// load_image -
+//    Maps the named host file and replaces the whole tree with the
+//    one in it, in time linear in the size of the image.  The image
+//    is checked completely before the current tree is discarded.
+//    Afterwards the cwd is /.
+
+void save_image (inode_state& state, const string& filename);
+void load_image (inode_state& state, const string& filename);
+
+#endif
+
@@ -0,0 +1,159 @@
+// $Id: index.cpp,v 1.1 2026-10-18 14:00:00-07 - - $
+
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+#include "debug.h"
+#include "file_sys.h"
+#include "index.h"
+
+// Slot 0 is never given out, so it can stand for no block.
+
+word_index::word_index(): table (1024, 0), generations (1, 0) {
+}
+
+// probe -
+//    Returns the entry of the table holding the word, or the empty
+//    entry where it would go.  An entry holds the top half of the
+//    word's hash above one more than the index of the word, so 0 is
+//    empty and most other words are passed over without reading them.
+
+uint64_t* word_index::probe (string_view word, uint64_t hash) {
+   size_t mask = table.size() - 1;
+   uint64_t tag = hash & ~uint64_t (UINT32_MAX);
+   for (size_t index = hash & mask;; index = (index + 1) & mask) {
+      uint64_t& entry = table[index];
+      if (entry == 0) return &entry;
+      if ((entry & ~uint64_t (UINT32_MAX)) != tag) continue;
+      const word_entry& found = entries[(entry & UINT32_MAX) - 1];
+      if (string_view (chars).substr (found.chars, found.length)
+          == word) {
+         return &entry;
+      }
+   }
+}
+
+// grow -
+//    Doubles the table, keeping it at most half full.
+
+void word_index::grow() {
+   vector<uint64_t> grown (table.size() * 2, 0);
+   size_t mask = grown.size() - 1;
+   for (uint64_t entry: table) {
+      if (entry == 0) continue;
+      size_t index = entries[(entry & UINT32_MAX) - 1].hash & mask;
+      while (grown[index] != 0) index = (index + 1) & mask;
+      grown[index] = entry;
+   }
+   table.swap (grown);
+}
+
+// intern -
+//    Returns the index of the word's entry, adding one if need be.
+
+uint32_t word_index::intern (string_view word) {
+   uint64_t hash = std::hash<string_view>() (word);
+   uint64_t* entry = probe (word, hash);
+   if (*entry != 0) return (*entry & UINT32_MAX) - 1;
+   if ((entries.size() + 1) * 2 > table.size()) {
+      grow();
+      entry = probe (word, hash);
+   }
+   entries.push_back ({hash, static_cast<uint32_t> (chars.size()),
+                       static_cast<uint32_t> (word.size()), NONE, 0, 0});
+   chars.append (word);
+   *entry = (hash & ~uint64_t (UINT32_MAX)) | entries.size();
+   return entries.size() - 1;
+}
+
+uint32_t word_index::add (const file_words& words) {
+   uint32_t slot;
+   if (free_slots.empty()) {
+      slot = generations.size();
+      generations.push_back (0);
+   }else {
+      slot = free_slots.back();
+      free_slots.pop_back();
+   }
+   uint32_t generation = generations[slot];
+   // Pushed onto the chains last word first, so each chain holds the
+   // positions of a block in order.
+   for (size_t position = words.size(); position-- > 0; ) {
+      word_entry& word = entries[intern (words[position])];
+      uint32_t index = free_nodes;
+      if (index != NONE) {
+         free_nodes = nodes[index].next;
+      }else {
+         index = nodes.size();
+         nodes.emplace_back();
+      }
+      nodes[index] = {slot, generation, static_cast<uint32_t> (position),
+                      word.head};
+      word.head = index;
+      ++word.count;
+   }
+   postings_ += words.size();
+   ++blobs_;
+   TRACEF ('x', "slot = {}, words = {}", slot, words.size());
+   return slot;
+}
+
+// compact -
+//    Unlinks the dead postings of a word, putting their nodes on the
+//    free list.
+
+void word_index::compact (word_entry& word) {
+   uint32_t* link = &word.head;
+   while (*link != NONE) {
+      node& each = nodes[*link];
+      if (live (each)) {
+         link = &each.next;
+         continue;
+      }
+      uint32_t dead = *link;
+      *link = each.next;
+      each.next = free_nodes;
+      free_nodes = dead;
+      --word.count;
+      --postings_;
+   }
+   word.dead = 0;
+}
+
+void word_index::remove (uint32_t slot, const file_words& words) {
+   ++generations[slot];
+   free_slots.push_back (slot);
+   --blobs_;
+   for (string_view word: words) {
+      uint64_t* entry = probe (word, std::hash<string_view>() (word));
+      if (*entry == 0) continue;
+      word_entry& found = entries[(*entry & UINT32_MAX) - 1];
+      // A word twice in the block is counted twice, though the first
+      // compaction drops both, which only compacts the next sooner.
+      if (++found.dead * 2 >= found.count) compact (found);
+   }
+   TRACEF ('x', "slot = {}, words = {}", slot, words.size());
+}
+
+vector<word_index::posting> word_index::find (string_view word) {
+   vector<posting> result;
+   uint64_t* entry = probe (word, std::hash<string_view>() (word));
+   if (*entry == 0) return result;
+   for (uint32_t index = entries[(*entry & UINT32_MAX) - 1].head;
+        index != NONE;
+        index = nodes[index].next) {
+      const node& each = nodes[index];
+      if (live (each)) result.push_back ({each.slot, each.position});
+   }
+   return result;
+}
+
+ostream& operator<< (ostream& out, const word_index& index) {
+   out << "word_index: words = " << index.words()
+       << ", postings = " << index.postings()
+       << ", blobs = " << index.blobs();
+   return out;
+}
+
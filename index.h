@@ -0,0 +1,100 @@
+// $Id: index.h,v 1.1 2026-10-18 14:00:00-07 - - $
+
+// index -
+//    An inverted index of the words in the plain files of a
+//    filesystem, so a word is found without reading any file.
+
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+class file_words;
+
+// word_index -
+//    Maps each word onto where it occurs:  the block holding it, by
+//    the slot the index gives the block, and its position among the
+//    words of the block.  Kept by the blob store as blocks are
+//    interned and let go, so a block shared by many files is indexed
+//    once, and a file written over with contents some file already
+//    has costs nothing here.
+//    Words are found through an open addressed table, their chars
+//    kept back to back in one string, and the postings of every word
+//    are chained through one vector, newest block first, so indexing
+//    a word costs a probe and an append, not an allocation.  A word
+//    stays in the table once seen, even with no postings left.
+// add -
+//    Indexes every word of a block just interned, and returns the
+//    slot given to the block, which is never 0.
+// remove -
+//    Forgets the block in the slot, whose last file has let it go.
+//    The slot's generation is advanced, so the block's postings are
+//    dead at once, but they stay in their chains until they are half
+//    of those of a word, whose chain is then compacted.  A block then
+//    costs a probe per word to remove, not a walk of every chain it
+//    is in, and its slot may be given to the next block added.
+// find -
+//    Returns the postings of the word in blocks still indexed, newest
+//    block first and in order of position within a block.
+// words, postings, blobs -
+//    The number of distinct words seen, of postings kept, dead ones
+//    included, and of blocks indexed.
+//
+// Not locked, since the blob store calls it holding its own lock.
+
+class word_index {
+   friend ostream& operator<< (ostream& out, const word_index&);
+   public:
+      struct posting {
+         uint32_t slot;
+         uint32_t position;
+      };
+   private:
+      static constexpr uint32_t NONE = UINT32_MAX;
+      struct word_entry {
+         uint64_t hash;
+         uint32_t chars;
+         uint32_t length;
+         uint32_t head;
+         uint32_t count;
+         uint32_t dead;
+      };
+      struct node {
+         uint32_t slot;
+         uint32_t generation;
+         uint32_t position;
+         uint32_t next;
+      };
+      string chars;
+      vector<word_entry> entries;
+      vector<uint64_t> table;
+      vector<node> nodes;
+      uint32_t free_nodes {NONE};
+      vector<uint32_t> generations;
+      vector<uint32_t> free_slots;
+      size_t postings_ {0};
+      size_t blobs_ {0};
+      uint64_t* probe (string_view word, uint64_t hash);
+      uint32_t intern (string_view word);
+      void grow();
+      void compact (word_entry& word);
+      bool live (const node& each) const {
+         return generations[each.slot] == each.generation;
+      }
+   public:
+      word_index();
+      uint32_t add (const file_words& words);
+      void remove (uint32_t slot, const file_words& words);
+      vector<posting> find (string_view word);
+      size_t words() const {return entries.size();}
+      size_t postings() const {return postings_;}
+      size_t blobs() const {return blobs_;}
+};
+
+#endif
+
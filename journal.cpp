@@ -0,0 +1,497 @@
+// $Id: journal.cpp,v 1.1 2026-10-18 12:00:00-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "image.h"
+#include "journal.h"
+#include "server.h"
+
+namespace {
+
+constexpr char JOURNAL_MAGIC[8] {'Y', 'S', 'H', 'J', 'R', 'N', 'L', '1'};
+
+struct journal_header {
+   char magic[8];
+   uint64_t generation;
+};
+
+struct record_header {
+   uint32_t length;
+   uint32_t checksum;
+};
+
+// checksum -
+//    FNV-1a of the bytes, enough to tell a record written whole from
+//    one a crash cut short or left garbage in.
+
+uint32_t checksum (string_view bytes) {
+   uint32_t hash = 2166136261u;
+   for (char byte: bytes) {
+      hash ^= static_cast<unsigned char> (byte);
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+void put_size (string& out, size_t size) {
+   while (size >= 0x80) {
+      out += static_cast<char> ((size & 0x7F) | 0x80);
+      size >>= 7;
+   }
+   out += static_cast<char> (size);
+}
+
+bool get_size (string_view& in, size_t& size) {
+   size = 0;
+   for (size_t shift = 0; shift < 64 and not in.empty(); shift += 7) {
+      auto byte = static_cast<unsigned char> (in.front());
+      in.remove_prefix (1);
+      size |= size_t (byte & 0x7F) << shift;
+      if (byte < 0x80) return true;
+   }
+   return false;
+}
+
+// encode -
+//    Appends a record with the fields given to out, and returns its
+//    length, header and all.
+
+size_t encode (string& out, journal_op op,
+               initializer_list<string_view> head,
+               const wordview_range& tail) {
+   size_t start = out.size();
+   out.append (sizeof (record_header), '\0');
+   out += static_cast<char> (op);
+   for (string_view field: head) {
+      put_size (out, field.size());
+      out.append (field);
+   }
+   for (auto field = tail.first; field != tail.second; ++field) {
+      put_size (out, field->size());
+      out.append (*field);
+   }
+   size_t body = start + sizeof (record_header);
+   record_header header {static_cast<uint32_t> (out.size() - body),
+                         checksum ({out.data() + body,
+                                    out.size() - body})};
+   memcpy (&out[start], &header, sizeof header);
+   return out.size() - start;
+}
+
+// write_all -
+//    Writes all the bytes, returning 0 or the errno of the failure.
+
+int write_all (int fd, string_view bytes) {
+   while (not bytes.empty()) {
+      ssize_t count = write (fd, bytes.data(), bytes.size());
+      if (count < 0) {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+      bytes.remove_prefix (count);
+   }
+   return 0;
+}
+
+// sync_file -
+//    Syncs a file written through another descriptor, and returns its
+//    size.
+
+uint64_t sync_file (const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY | O_CLOEXEC);
+   struct stat status;
+   if (fd < 0 or fsync (fd) < 0 or fstat (fd, &status) < 0) {
+      int error = errno;
+      if (fd >= 0) close (fd);
+      throw journal_error (filename + ": " + strerror (error));
+   }
+   close (fd);
+   return status.st_size;
+}
+
+// sync_directory -
+//    Syncs the directory holding a file, so a rename in it is on disk.
+
+void sync_directory (const string& filename) {
+   size_t slash = filename.rfind ('/');
+   string dirname = slash == string::npos ? "."
+                  : slash == 0 ? "/" : filename.substr (0, slash);
+   int fd = open (dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd < 0 or fsync (fd) < 0) {
+      int error = errno;
+      if (fd >= 0) close (fd);
+      throw journal_error (dirname + ": " + strerror (error));
+   }
+   close (fd);
+}
+
+}
+
+journal_error::journal_error (const string& what): runtime_error (what) {
+}
+
+journal::journal (inode_state& state, const string& path_):
+         owner (state), fs (state.getFileSystem()), path (path_) {
+   int existing = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (existing < 0) {
+      if (errno != ENOENT) {
+         throw journal_error (path + ": " + strerror (errno));
+      }
+      cwd = owner.getCwdPath();
+      begin (0);
+      // Anything already in the tree is kept by a checkpoint.
+      if (owner.getRoot()->getContents()->size() > 2) {
+         try {
+            checkpoint (owner);
+         }catch (journal_error&) {
+            close (fd);
+            throw;
+         }
+      }
+      fs.set_journal (this);
+      return;
+   }
+   string contents = read_all (existing);
+   close (existing);
+   journal_header header;
+   if (contents.size() < sizeof header) {
+      throw journal_error (path + ": not a valid journal: too short");
+   }
+   memcpy (&header, contents.data(), sizeof header);
+   if (memcmp (header.magic, JOURNAL_MAGIC, sizeof header.magic) != 0) {
+      throw journal_error (path + ": not a valid journal: "
+                           "bad magic number");
+   }
+   if (header.generation > 0) {
+      try {
+         load_image (owner, image_name (header.generation));
+      }catch (image_error& error) {
+         throw journal_error (path + ": checkpoint: " + error.what());
+      }
+      struct stat status;
+      if (stat (image_name (header.generation).c_str(), &status) == 0) {
+         image_bytes = status.st_size;
+      }
+   }
+   generation = header.generation;
+   size_t good = sizeof header;
+   replay (owner, contents, good);
+   fd = open (path.c_str(), O_WRONLY | O_CLOEXEC);
+   if (fd < 0) throw journal_error (path + ": " + strerror (errno));
+   if (good < contents.size()) {
+      // Cut off what a crash left half written.
+      TRACEF ('j', "cut {} bytes", contents.size() - good);
+      if (ftruncate (fd, good) < 0 or fdatasync (fd) < 0) {
+         int error = errno;
+         close (fd);
+         throw journal_error (path + ": " + strerror (error));
+      }
+   }
+   lseek (fd, good, SEEK_SET);
+   journal_bytes = good;
+   // Left if a crash came between starting this journal and removing
+   // the checkpoint before it.
+   if (generation > 1) unlink (image_name (generation - 1).c_str());
+   fs.set_journal (this);
+}
+
+journal::~journal() {
+   fs.set_journal (nullptr);
+   if (fd >= 0) close (fd);
+}
+
+string journal::image_name (uint64_t gen) const {
+   return path + "." + to_string (gen) + ".image";
+}
+
+// begin -
+//    Writes a journal following the checkpoint of the given
+//    generation, holding only the cwd, which checkpoints do not, and
+//    puts it in place of the old one, which is then no longer written.
+
+void journal::begin (uint64_t gen) {
+   string contents (sizeof (journal_header), '\0');
+   journal_header header {};
+   memcpy (header.magic, JOURNAL_MAGIC, sizeof header.magic);
+   header.generation = gen;
+   memcpy (&contents[0], &header, sizeof header);
+   wordviews names (cwd.cbegin(), cwd.cend());
+   encode (contents, journal_op::CWD, {}, {names.cbegin(), names.cend()});
+   string fresh = path + ".new";
+   int newfd = open (fresh.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+                                    | O_CLOEXEC, 0666);
+   if (newfd < 0) throw journal_error (fresh + ": " + strerror (errno));
+   int error = write_all (newfd, contents);
+   if (error == 0 and fdatasync (newfd) < 0) error = errno;
+   if (error == 0 and rename (fresh.c_str(), path.c_str()) < 0) {
+      error = errno;
+   }
+   if (error != 0) {
+      close (newfd);
+      unlink (fresh.c_str());
+      throw journal_error (path + ": " + strerror (error));
+   }
+   if (fd >= 0) close (fd);
+   fd = newfd;
+   generation = gen;
+   journal_bytes = contents.size();
+   sync_directory (path);
+}
+
+// replay -
+//    Applies the records from good on to the tree, advancing good past
+//    each, and stops at the first which is not whole.
+
+void journal::replay (inode_state& state, string_view contents,
+                      size_t& good) {
+   inode_table& table = state.getTable();
+   wordviews fields;
+   wordviews names;
+   // Records mostly follow others in the same directory, so the last
+   // inode found is kept, until anything is removed or copied.
+   string_view found_path;
+   inode_ptr found {nullptr};
+   auto find = [&] (string_view pathname) -> inode& {
+      if (found != nullptr and pathname == found_path) return *found;
+      inode_ptr node = state.getRoot();
+      tokenize (pathname, "/", names);
+      for (string_view name: names) {
+         size_t nr = table.dir (*node).lookup (name);
+         if (nr == 0) throw file_error (string (name) + ": not found");
+         node = &table[nr];
+      }
+      found_path = pathname;
+      found = node;
+      return *node;
+   };
+   uint64_t replayed = 0;
+   for (;;) {
+      record_header header;
+      string_view rest = contents.substr (good);
+      if (rest.size() < sizeof header) break;
+      memcpy (&header, rest.data(), sizeof header);
+      if (header.length == 0
+          or header.length > rest.size() - sizeof header) break;
+      string_view body = rest.substr (sizeof header, header.length);
+      if (checksum (body) != header.checksum) break;
+      auto op = static_cast<journal_op> (body.front());
+      body.remove_prefix (1);
+      fields.clear();
+      while (not body.empty()) {
+         size_t length;
+         if (not get_size (body, length) or length > body.size()) {
+            throw journal_error (path + ": record " + to_string (replayed)
+                                 + ": bad field");
+         }
+         fields.push_back (body.substr (0, length));
+         body.remove_prefix (length);
+      }
+      size_t needed = op == journal_op::CWD ? 0
+                    : op == journal_op::CLONE ? 3 : 2;
+      if (fields.size() < needed or (fields.size() > needed
+                                     and op != journal_op::MAKE
+                                     and op != journal_op::CWD)) {
+         throw journal_error (path + ": record " + to_string (replayed)
+                              + ": bad fields");
+      }
+      try {
+         string name = needed > 0 ? string (fields[needed - 1]) : "";
+         switch (op) {
+            case journal_op::MKDIR:
+               table.dir (find (fields[0])).mkdir (name);
+               break;
+            case journal_op::MAKE: {
+               directory& dir = table.dir (find (fields[0]));
+               size_t nr = dir.lookup (name);
+               inode_ptr file = nr != 0 ? &table[nr] : dir.mkfile (name);
+               table.writable (*file).writefile (
+                     wordview_range (fields.cbegin() + 2, fields.cend()));
+               break;
+            }
+            case journal_op::REMOVE:
+               table.dir (find (fields[0])).remove (name);
+               found = nullptr;
+               break;
+            case journal_op::CLONE: {
+               inode_ptr copy = table.clone (find (fields[0]));
+               table.dir (find (fields[1])).link (name, copy);
+               found = nullptr;
+               break;
+            }
+            case journal_op::CWD:
+               cwd.assign (fields.cbegin(), fields.cend());
+               break;
+            default:
+               throw file_error ("bad record type");
+         }
+      }catch (runtime_error& error) {
+         throw journal_error (path + ": record " + to_string (replayed)
+                              + ": " + error.what());
+      }
+      good += sizeof header + header.length;
+      ++replayed;
+   }
+   records += replayed;
+   // Found as a session finds its cwd after another has changed the
+   // tree, or made /, if it is gone.
+   state.getCwdPath() = cwd;
+   state.getFileSystem().changed();
+   state.follow_changes();
+   cwd = state.getCwdPath();
+   TRACEF ('j', "replayed {} records, generation {}", replayed,
+           generation);
+}
+
+void journal::append (journal_op op, initializer_list<string_view> head,
+                      const wordview_range& tail) {
+   if (failed) return;
+   size_t length = encode (buffer, op, head, tail);
+   appended += length;
+   journal_bytes += length;
+   ++records;
+}
+
+void journal::commit() {
+   unique_lock<mutex> held (lock);
+   commit (held);
+}
+
+void journal::commit (unique_lock<mutex>& held) {
+   uint64_t wanted = appended;
+   if (durable < wanted and not failed) ++commits;
+   while (durable < wanted and not failed) {
+      if (syncing) {
+         synced.wait (held);
+         continue;
+      }
+      // Everything appended until now goes in this write, including
+      // what other sessions appended while the last was syncing.
+      syncing = true;
+      spare.swap (buffer);
+      uint64_t batch = appended;
+      held.unlock();
+      int error = write_all (fd, spare);
+      if (error == 0 and fdatasync (fd) < 0) error = errno;
+      held.lock();
+      syncing = false;
+      spare.clear();
+      synced.notify_all();
+      if (error != 0) {
+         failed = true;
+         throw journal_error (path + ": " + strerror (error));
+      }
+      durable = batch;
+      ++syncs;
+   }
+}
+
+bool journal::commit_due() {
+   lock_guard<mutex> guard (lock);
+   return buffer.size() >= GROUP_BYTES;
+}
+
+void journal::checkpoint (inode_state& state) {
+   unique_lock<mutex> held (lock);
+   commit (held);
+   synced.wait (held, [this] {return not syncing;});
+   uint64_t next = generation + 1;
+   try {
+      try {
+         save_image (state, image_name (next));
+      }catch (image_error& error) {
+         throw journal_error (error.what());
+      }
+      uint64_t bytes = sync_file (image_name (next));
+      begin (next);
+      image_bytes = bytes;
+   }catch (journal_error&) {
+      // Not tried again until the journal has grown as much again.
+      image_bytes = journal_bytes;
+      throw;
+   }
+   if (next > 1) unlink (image_name (next - 1).c_str());
+   TRACEF ('j', "checkpoint {}, image = {} bytes", next, image_bytes);
+}
+
+bool journal::checkpoint_due() {
+   lock_guard<mutex> guard (lock);
+   return not failed
+          and journal_bytes > max (CHECKPOINT_MIN_BYTES, image_bytes);
+}
+
+void journal::print (ostream& out) {
+   lock_guard<mutex> guard (lock);
+   out << "journal: generation = " << generation
+       << ", records = " << records
+       << ", bytes = " << journal_bytes
+       << ", commits = " << commits
+       << ", syncs = " << syncs << endl;
+}
+
+journal_entry::journal_entry (inode_state& state_):
+               state (state_),
+               log (state.getFileSystem().getJournal()) {
+   if (log != nullptr) held = unique_lock<mutex> (log->lock);
+}
+
+void journal_entry::append (journal_op op, inode& parent,
+                            string_view name,
+                            const wordview_range& tail) {
+   if (log == nullptr) return;
+   string where = state.getTable().path (parent.get_inode_nr());
+   log->append (op, {where, name}, tail);
+}
+
+void journal_entry::mkdir (inode& parent, string_view name) {
+   append (journal_op::MKDIR, parent, name);
+}
+
+void journal_entry::make (inode& parent, string_view name,
+                          const wordview_range& words) {
+   append (journal_op::MAKE, parent, name, words);
+}
+
+void journal_entry::remove (inode& parent, string_view name) {
+   append (journal_op::REMOVE, parent, name);
+}
+
+void journal_entry::clone (inode& source, inode& parent,
+                           string_view name) {
+   if (log == nullptr) return;
+   inode_table& table = state.getTable();
+   string from = table.path (source.get_inode_nr());
+   string where = table.path (parent.get_inode_nr());
+   log->append (journal_op::CLONE, {from, where, name}, {});
+}
+
+void journal_entry::cwd() {
+   if (log == nullptr or &state != &log->owner) return;
+   log->cwd = state.getCwdPath();
+   wordviews names (log->cwd.cbegin(), log->cwd.cend());
+   log->append (journal_op::CWD, {}, {names.cbegin(), names.cend()});
+}
+
+void settle_journal (inode_state& state, bool waiting) {
+   journal* log = state.getFileSystem().getJournal();
+   if (log == nullptr) return;
+   try {
+      if (log->checkpoint_due()) {
+         static const wordviews words {"checkpoint"};
+         command_guard guard (state, words);
+         // Unless another session took it first.
+         if (log->checkpoint_due()) log->checkpoint (state);
+      }
+      if (waiting or log->commit_due()) log->commit();
+   }catch (journal_error& error) {
+      complain() << error.what() << endl;
+   }
+}
+
@@ -0,0 +1,185 @@
+// $Id: journal.h,v 1.1 2026-10-18 12:00:00-07 - - $
+
+// journal -
+//    Keeps the filesystem on the host as it changes, so a shell which
+//    runs for a long time need not save a whole image after every
+//    change, and loses nothing but what was not yet committed when it
+//    crashes.  Each change a command makes is appended to the journal
+//    as a compact binary record, and from time to time the tree is
+//    saved as a checkpoint image and the journal started again.  At
+//    startup, the checkpoint is loaded and the records after it are
+//    applied straight to the tree, without running the commands.
+//
+//    A journal is, in native byte order:
+//       the header, with the generation of the checkpoint it follows,
+//          or 0 if it follows an empty tree;
+//       the records, each its length and a checksum of the rest, then
+//          the kind of change and its fields, each a length and the
+//          bytes, lengths as 7 bits a byte, least significant first.
+//    The checkpoint of generation g is the image journal.g.image.  A
+//    record cut short or failing its checksum is taken to be where a
+//    crash stopped the journal being written, and is cut off with
+//    everything after it.
+//
+//    Pathnames are recorded from the root, and replayed in the order
+//    their changes were made, so the tree replayed is the one left.
+//    Its inode numbers are the same unless numbers freed were reused,
+//    whose order depends on when they were freed, or copies were
+//    looked into, which numbers their entries.
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+using namespace std;
+
+#include "file_sys.h"
+#include "util.h"
+
+// journal_error -
+//    Thrown when a journal or checkpoint cannot be read or written,
+//    or a record cannot be replayed.
+
+class journal_error: public runtime_error {
+   public:
+      explicit journal_error (const string& what);
+};
+
+// journal_op -
+//    The kind of change a record holds, and its fields:
+//       MKDIR, parent, name:  a directory made;
+//       MAKE, parent, name, words:  a file made or written;
+//       REMOVE, parent, name:  an entry removed, with all below it;
+//       CLONE, source, parent, name:  a copy made by cp;
+//       CWD, names:  the cwd, by the names leading to it.
+
+enum class journal_op: uint8_t {MKDIR = 1, MAKE, REMOVE, CLONE, CWD};
+
+// journal -
+//    The journal of a filesystem, attached to it while it lives.
+// ctor -
+//    Opens the named journal, loading its checkpoint and replaying
+//    its records onto the tree of the session given, whose cwd it
+//    then keeps, or makes a new one holding the tree as it is.
+//    Throws a journal_error if the journal is there but cannot be
+//    read or replayed, leaving it as it was.
+// commit -
+//    Writes every record appended so far and waits until the host
+//    has them on disk.  Sessions committing at once share one write
+//    and sync, made by whichever comes first while the others wait,
+//    so the cost of syncing is spread across all of them.  Throws a
+//    journal_error if the write fails, after which the journal takes
+//    no more records and commits do nothing.
+// commit_due -
+//    Whether enough records wait to be worth a commit even though
+//    nobody is waiting for them.
+// checkpoint -
+//    Commits, saves the tree as the checkpoint of the next generation
+//    and starts a journal following it, which replaces the old one
+//    only once everything is on disk, so a crash at any point leaves
+//    either the old checkpoint and journal or the new ones.  The
+//    caller holds the tree lock exclusive, as for save.
+// checkpoint_due -
+//    Whether the journal has grown past the checkpoint it follows,
+//    after which replaying it would take longer than loading a new
+//    one, so checkpoints cost no more than the changes they hold.
+// print -
+//    Prints the generation, the records and bytes appended, and the
+//    commits made and how many of them wrote and synced.
+
+class journal {
+   friend class journal_entry;
+   private:
+      static constexpr size_t GROUP_BYTES = 1 << 20;
+      static constexpr uint64_t CHECKPOINT_MIN_BYTES = 4 << 20;
+      inode_state& owner;
+      file_system& fs;
+      string path;
+      int fd {-1};
+      uint64_t generation {0};
+      // Taken by journal_entry around each change, so records are
+      // appended in the order their changes are seen, and held over
+      // everything else, but while writing and syncing.
+      mutex lock;
+      condition_variable synced;
+      string buffer;
+      string spare;
+      bool syncing {false};
+      bool failed {false};
+      uint64_t appended {0};
+      uint64_t durable {0};
+      uint64_t journal_bytes {0};
+      uint64_t image_bytes {0};
+      uint64_t records {0};
+      uint64_t commits {0};
+      uint64_t syncs {0};
+      wordvec cwd;
+      string image_name (uint64_t gen) const;
+      void begin (uint64_t gen);
+      void append (journal_op op, initializer_list<string_view> head,
+                   const wordview_range& tail);
+      void commit (unique_lock<mutex>& held);
+      void replay (inode_state& state, string_view records,
+                   size_t& good);
+   public:
+      journal (inode_state& state, const string& path_);
+      ~journal();
+      journal (const journal&) = delete;
+      journal& operator= (const journal&) = delete;
+      void commit();
+      bool commit_due();
+      void checkpoint (inode_state& state);
+      bool checkpoint_due();
+      void print (ostream& out);
+};
+
+// journal_entry -
+//    Held by a command across a change it makes, taken once it holds
+//    the locks of the directories it changes, and recording the
+//    change once it is made, before anybody else can record a change
+//    which follows from it.  Holds nothing if the filesystem has no
+//    journal.  A change which throws is not recorded.
+// mkdir, make, remove, clone -
+//    Record the changes of the same names, given the directory the
+//    entry changed is in and its name.
+// cwd -
+//    Records the cwd of the session, if it is the one the journal
+//    keeps the cwd of.
+
+class journal_entry {
+   private:
+      inode_state& state;
+      journal* log;
+      unique_lock<mutex> held;
+      void append (journal_op op, inode& parent, string_view name,
+                   const wordview_range& tail = {});
+   public:
+      explicit journal_entry (inode_state& state_);
+      journal_entry (const journal_entry&) = delete;
+      journal_entry& operator= (const journal_entry&) = delete;
+      void mkdir (inode& parent, string_view name);
+      void make (inode& parent, string_view name,
+                 const wordview_range& words);
+      void remove (inode& parent, string_view name);
+      void clone (inode& source, inode& parent, string_view name);
+      void cwd();
+};
+
+// settle_journal -
+//    Called by each session between commands.  Takes a checkpoint if
+//    one is due, holding the tree lock as a command would, and
+//    commits if the session is about to wait for input, so whoever
+//    it answers sees only what is on disk, or if a commit is due.
+//    Errors are complained of, not thrown.
+
+void settle_journal (inode_state& state, bool waiting);
+
+#endif
+
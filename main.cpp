@@ -2,7 +2,10 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <unistd.h>
 
@@ -11,20 +14,101 @@ using namespace std;
 #include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
+#include "host.h"
+#include "image.h"
+#include "journal.h"
+#include "pipeline.h"
+#include "server.h"
+#include "stats.h"
 #include "util.h"
 
+// yshell_options -
+//    Settings taken from the command line.
+//    batch:  -b reads the whole script from cin before running it
+//    and writes the transcript through one large buffer instead of
+//    flushing every line.  The transcript is the same as the echoed
+//    one printed when cin is not a tty.
+//    image:  -l image loads a saved image before reading commands.
+//    import:  -i hostdir copies a host directory into / before
+//    reading commands, after any image is loaded.
+//    journal:  -j journal replays the journal and its checkpoint
+//    before anything else, then records every change made to the
+//    tree in it.  An image loaded or a directory imported is kept as
+//    a new checkpoint.  Changes are committed before each prompt
+//    when cin is a tty, and otherwise a batch at a time.
+//    deferred:  -d makes rm and rmr return at once, leaving what they
+//    remove to be freed a batch at a time between later commands.
+//    pipelined:  -p reads and splits lines on one thread and writes
+//    the transcript on another while commands run on the main one.
+//    Ignored when cin is a tty, where each prompt must come before
+//    the line is read.
+//    stats:  -s prints the counts and latencies of the commands run
+//    and the gauges of the filesystem to cerr at exit, as the stats
+//    command would.
+//    archive:  -e keeps the standard output for archives written by
+//    export -, sending the transcript to cerr instead, so that the
+//    output of yshell -e can be piped into tar.
+//    socket:  -u socket also serves sessions on the Unix domain
+//    socket, sharing the filesystem, while commands are read from
+//    cin, and stops once cin ends.  Turns -d off, since freeing
+//    between commands would need every directory locked.
+
+struct yshell_options {
+   bool archive {false};
+   bool batch {false};
+   bool deferred {false};
+   bool pipelined {false};
+   bool stats {false};
+   string image;
+   string import;
+   string journal;
+   string socket;
+};
+
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis:  -@flags sets debug flags, -b is batch mode,
+//    -d defers reclamation, -e keeps cout for archives,
+//    -i hostdir imports a host directory,
+//    -j journal keeps a journal, -l image loads an image,
+//    -p pipelines, -s prints stats at exit, -u socket serves sessions.
 
-void scan_options (int argc, char** argv) {
+yshell_options scan_options (int argc, char** argv) {
+   yshell_options options;
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:bdei:j:l:psu:");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'b':
+            options.batch = true;
+            break;
+         case 'd':
+            options.deferred = true;
+            break;
+         case 'e':
+            options.archive = true;
+            break;
+         case 'i':
+            options.import = optarg;
+            break;
+         case 'j':
+            options.journal = optarg;
+            break;
+         case 'l':
+            options.image = optarg;
+            break;
+         case 'p':
+            options.pipelined = true;
+            break;
+         case 's':
+            options.stats = true;
+            break;
+         case 'u':
+            options.socket = optarg;
+            break;
          default:
             complain() << "-" << static_cast<char> (option)
                        << ": invalid option" << endl;
@@ -34,8 +118,31 @@ void scan_options (int argc, char** argv) {
    if (optind < argc) {
       complain() << "operands not permitted" << endl;
    }
+   return options;
 }
 
+// batch_buffer -
+//    Output buffer for cout in batch mode.  Static, so that it is
+//    still there when cout is flushed after main returns.
+
+static char batch_buffer[1 << 20];
+
+// parsed_line -
+//    A line of the script and views of its words, as passed from the
+//    reader thread to the main thread in pipelined mode.  An item with
+//    eof set follows the last line.
+
+struct parsed_line {
+   string line;
+   wordviews words;
+   bool eof {false};
+};
+
+// PIPELINE_DEPTH -
+//    How many lines the reader thread may run ahead.
+
+constexpr size_t PIPELINE_DEPTH = 1024;
+
 
 // main -
 //    Main program which loops reading commands until end of file.
@@ -44,42 +151,206 @@ int main (int argc, char** argv) {
    exec::execname (argv[0]);
    cout << boolalpha;  // Print false or true instead of 0 or 1.
    cerr << boolalpha;
-   cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
-   scan_options (argc, argv);
-   bool need_echo = want_echo();
+   yshell_options options = scan_options (argc, argv);
+   if (options.pipelined and isatty (STDIN_FILENO)) {
+      options.pipelined = false;
+   }
+   if (not options.socket.empty()) options.deferred = false;
+   string script;
+   string_view unread;
+   if (options.batch or options.pipelined) {
+      ios_base::sync_with_stdio (false);
+   }
+   if (options.batch) {
+      // Must come before any output.  cerr stays tied to cout, so
+      // error messages still appear in order.
+      cout.rdbuf()->pubsetbuf (batch_buffer, sizeof batch_buffer);
+      script = read_all (STDIN_FILENO);
+      unread = script;
+   }
+   // Replaces the buffer of cout, and so also must come before any
+   // output.
+   unique_ptr<output_pipe> pipe;
+   streambuf* cout_buffer = cout.rdbuf();
+   if (options.pipelined) {
+      pipe = make_unique<output_pipe> (STDOUT_FILENO);
+      cout.rdbuf (pipe.get());
+      // Otherwise the reader thread would flush cout at every line.
+      cin.tie (nullptr);
+   }
+   // Whatever buffer cout has by now carries the archive alone, and
+   // the transcript goes through cout to cerr's.
+   ostream archive (cout.rdbuf());
+   if (options.archive) cout.rdbuf (cerr.rdbuf());
+   cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << "\n";
+   bool need_echo = options.batch or want_echo();
+   bool interactive = not options.batch and isatty (STDIN_FILENO);
    inode_state state;
+   state.getTable().set_deferred (options.deferred);
+   if (options.archive) state.set_archive (&archive);
+   unique_ptr<journal> log;
+   if (not options.journal.empty()) {
+      try {
+         log = make_unique<journal> (state, options.journal);
+      }catch (journal_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   if (not options.image.empty()) {
+      try {
+         load_image (state, options.image);
+      }catch (image_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   if (not options.import.empty()) {
+      try {
+         import_tree (state, options.import,
+                      [&]() -> inode& {return *state.getRoot();});
+      }catch (host_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   if (log != nullptr
+       and not (options.image.empty() and options.import.empty())) {
+      try {
+         log->checkpoint (state);
+      }catch (journal_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   unique_ptr<session_server> server;
+   if (not options.socket.empty()) {
+      try {
+         server = make_unique<session_server> (state.getFileSystem(),
+                                               options.socket);
+      }catch (server_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+
+   // read_line -
+   //    Like getline, except in batch mode, where lines are cut out of
+   //    the script already read.  As with getline at end of file, a
+   //    last line without a newline is not returned.
+   auto read_line = [&] (string& line) -> bool {
+      if (not options.batch) {
+         getline (cin, line);
+         return not cin.eof();
+      }
+      size_t newline = unread.find ('\n');
+      if (newline == string_view::npos) return false;
+      line.assign (unread.substr (0, newline));
+      unread.remove_prefix (newline + 1);
+      return true;
+   };
+
+   // next_line -
+   //    Returns the next line and its words, or nullptr at end of
+   //    file.  The line is read into the same parsed_line every time,
+   //    or in pipelined mode, is the next slot the reader thread has
+   //    filled, used in place until the following call.  Either way,
+   //    once the buffers have grown nothing is allocated per line.
+   spsc_ring<parsed_line> parsed {PIPELINE_DEPTH};
+   parsed_line current;
+   bool holding = false;
+   bool at_eof = false;
+   auto next_line = [&] () -> const parsed_line* {
+      parsed_line* next = &current;
+      if (options.pipelined) {
+         if (holding) parsed.release();
+         next = &parsed.front();
+         holding = true;
+      }else if (read_line (current.line)) {
+         tokenize (current.line, " \t", current.words);
+      }else {
+         current.eof = true;
+      }
+      at_eof = next->eof;
+      return at_eof ? nullptr : next;
+   };
+   thread reader;
+   if (options.pipelined) {
+      reader = thread ([&] {
+         for (;;) {
+            parsed_line& next = parsed.back();
+            next.eof = not read_line (next.line);
+            if (not next.eof) tokenize (next.line, " \t", next.words);
+            bool last = next.eof;
+            parsed.commit();
+            if (last) break;
+         }
+      });
+   }
+
    try {
       for (;;) {
          try {
             // Read a line, break at EOF, and echo print the prompt
             // if one is needed.
             cout << state.prompt();
-            string line;
-            getline (cin, line);
-            if (cin.eof()) {
+            settle_journal (state, interactive);
+            const parsed_line* next = next_line();
+            if (next == nullptr) {
                if (need_echo) cout << "^D";
-               cout << endl;
-               DEBUGF ('y', "EOF");
+               cout << "\n";
+               TRACEF ('y', "EOF");
                break;
             }
-            if (need_echo) cout << line << endl;
+            if (need_echo) cout << next->line << "\n";
    
-            // Split the line into words and lookup the appropriate
-            // function.  Complain or call it.
-            wordvec words = split (line, " \t");
+            // Lookup the function for the words of the line.
+            // Complain or call it.
+            const wordviews& words = next->words;
             DEBUGF ('y', "words = " << words);
             command_fn fn = find_command_fn (words.at(0));
+            command_timer timer (fn, words[0]);
+            command_guard guard (state, words);
             fn (state, words);
          }catch (command_error& error) {
             // If there is a problem discovered in any function, an
             // exn is thrown and printed here.
             complain() << error.what() << endl;
+         }catch (file_error& error) {
+            // As when another session removed the directory a command
+            // was making something in, which session threads report
+            // the same way.
+            complain() << error.what() << endl;
+         }
+         if (options.deferred) {
+            state.getTable().reclaim (inode_table::RECLAIM_BATCH);
          }
       }
    } catch (ysh_exit&) {
       // This catch intentionally left blank.
    }
+   if (reader.joinable()) {
+      // After exit, let the reader run to the end so it can stop.
+      while (not at_eof) next_line();
+      reader.join();
+   }
+   if (server != nullptr) server->stop();
+   if (log != nullptr) {
+      try {
+         log->commit();
+      }catch (journal_error& error) {
+         complain() << error.what() << endl;
+      }
+   }
+   DEBUGF ('y', state.getDcache());
+   DEBUGF ('y', state.getArena());
+   if (options.stats) {
+      cout.flush();
+      command_stats::print (cerr, state);
+   }
 
-   return exit_status_message();
+   int status = exit_status_message();
+   archive.flush();
+   if (options.archive) cout.rdbuf (archive.rdbuf());
+   if (pipe != nullptr) {
+      pipe->close();
+      cout.rdbuf (cout_buffer);
+   }
+   return status;
 }
 
@@ -0,0 +1,105 @@
+// $Id: pipeline.cpp,v 1.1 2026-10-18 07:30:00-07 - - $
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "pipeline.h"
+#include "util.h"
+
+output_pipe::output_pipe (int fd_): fd (fd_) {
+   // One buffer is always being filled, so the rest fit in the ring.
+   for (size_t count = 1; count < BUFFERS; ++count) {
+      empty.push ({make_unique<char[]> (BUFFER_SIZE), 0});
+   }
+   current.data = make_unique<char[]> (BUFFER_SIZE);
+   setp (current.data.get(), current.data.get() + BUFFER_SIZE);
+   writer = thread (&output_pipe::write_all, this);
+}
+
+output_pipe::~output_pipe() {
+   close();
+}
+
+// hand_over -
+//    Passes the filled part of the current buffer to the writer and
+//    takes an empty one back.
+
+void output_pipe::hand_over() {
+   current.used = pptr() - pbase();
+   if (current.used == 0) return;
+   full.push (move (current));
+   handed.fetch_add (1, memory_order_release);
+   empty.pop (current);
+   setp (current.data.get(), current.data.get() + BUFFER_SIZE);
+}
+
+// write_all -
+//    The writer thread.  Once a write fails, say on a closed pipe,
+//    the rest of the output is dropped rather than blocking the
+//    shell, as cout would after an error.
+
+void output_pipe::write_all() {
+   bool failed = false;
+   for (;;) {
+      chunk next;
+      full.pop (next);
+      if (next.data == nullptr) break;
+      for (size_t done = 0; not failed and done < next.used;) {
+         ssize_t count = ::write (fd, next.data.get() + done,
+                                  next.used - done);
+         if (count < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+         }
+         done += count;
+      }
+      next.used = 0;
+      empty.push (move (next));
+      written.fetch_add (1, memory_order_release);
+   }
+}
+
+output_pipe::int_type output_pipe::overflow (int_type ch) {
+   hand_over();
+   if (traits_type::eq_int_type (ch, traits_type::eof())) {
+      return traits_type::not_eof (ch);
+   }
+   *pptr() = traits_type::to_char_type (ch);
+   pbump (1);
+   return ch;
+}
+
+streamsize output_pipe::xsputn (const char* chars, streamsize count) {
+   streamsize done = 0;
+   while (done < count) {
+      if (pptr() == epptr()) hand_over();
+      streamsize room = min<streamsize> (epptr() - pptr(), count - done);
+      memcpy (pptr(), chars + done, room);
+      pbump (static_cast<int> (room));
+      done += room;
+   }
+   return done;
+}
+
+int output_pipe::sync() {
+   hand_over();
+   while (written.load (memory_order_acquire)
+          < handed.load (memory_order_relaxed)) {
+      this_thread::yield();
+   }
+   return 0;
+}
+
+void output_pipe::close() {
+   if (not writer.joinable()) return;
+   sync();
+   full.push ({});
+   writer.join();
+   TRACEF ('y', "output_pipe: buffers written = {}", written.load());
+}
+
@@ -0,0 +1,132 @@
+// $Id: pipeline.h,v 1.1 2026-10-18 07:30:00-07 - - $
+
+// pipeline -
+//    The pieces of the pipelined mode, in which one thread reads and
+//    tokenizes the script, the main thread executes commands, and a
+//    third thread writes the transcript, each running ahead of the
+//    next as far as the rings between them allow.
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <atomic>
+#include <memory>
+#include <streambuf>
+#include <thread>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// spsc_ring -
+//    A bounded lock-free queue for exactly one producer thread and
+//    one consumer thread.  Each side owns one index and only reads the
+//    other's, so a push or pop costs one atomic load and one atomic
+//    store.  A side which finds the ring full or empty yields until it
+//    is not.  The capacity is rounded up to a power of two.
+// push -
+//    Moves an item in, waiting for room.  Producer only.
+// pop -
+//    Moves the oldest item out, waiting for one.  Consumer only.
+// back, commit -
+//    Waits for room and returns the next free slot, to be filled in
+//    place, then passes it to the consumer.  A slot keeps whatever it
+//    held the last time round, so its buffers are reused.
+// front, release -
+//    Waits for an item and returns it, to be used in place, then
+//    gives its slot back to the producer.
+
+template <typename item_t>
+class spsc_ring {
+   private:
+      vector<item_t> slots;
+      size_t mask;
+      // Apart, so the two threads do not share a cache line.
+      alignas (64) atomic<size_t> head {0};
+      alignas (64) atomic<size_t> tail {0};
+   public:
+      explicit spsc_ring (size_t capacity) {
+         size_t size = 1;
+         while (size < capacity) size <<= 1;
+         slots.resize (size);
+         mask = size - 1;
+      }
+      spsc_ring (const spsc_ring&) = delete;
+      spsc_ring& operator= (const spsc_ring&) = delete;
+      item_t& back() {
+         size_t at = tail.load (memory_order_relaxed);
+         while (at - head.load (memory_order_acquire) > mask) {
+            this_thread::yield();
+         }
+         return slots[at & mask];
+      }
+      void commit() {
+         tail.store (tail.load (memory_order_relaxed) + 1,
+                     memory_order_release);
+      }
+      item_t& front() {
+         size_t at = head.load (memory_order_relaxed);
+         while (tail.load (memory_order_acquire) == at) {
+            this_thread::yield();
+         }
+         return slots[at & mask];
+      }
+      void release() {
+         head.store (head.load (memory_order_relaxed) + 1,
+                     memory_order_release);
+      }
+      void push (item_t&& item) {
+         back() = move (item);
+         commit();
+      }
+      void pop (item_t& item) {
+         item = move (front());
+         release();
+      }
+};
+
+// output_pipe -
+//    A streambuf which fills fixed-size buffers and hands each full
+//    one to a writer thread, which writes it to the file descriptor
+//    while the next is filled.  Installed as the rdbuf of cout.
+// sync -
+//    Hands over the partly filled buffer and waits until the writer
+//    has written everything.  Since cerr is tied to cout, this runs
+//    before every error message, so errors still appear in order.
+// close -
+//    Syncs, then stops and joins the writer.  Also done by the dtor.
+
+class output_pipe: public streambuf {
+   private:
+      static constexpr size_t BUFFER_SIZE = 1 << 16;
+      static constexpr size_t BUFFERS = 8;
+      // A buffer and how much of it is filled.  One without data
+      // tells the writer to stop.
+      struct chunk {
+         unique_ptr<char[]> data;
+         size_t used {0};
+      };
+      int fd;
+      // Full buffers go to the writer and come back empty.
+      spsc_ring<chunk> full {BUFFERS};
+      spsc_ring<chunk> empty {BUFFERS};
+      chunk current;
+      atomic<size_t> handed {0};
+      atomic<size_t> written {0};
+      thread writer;
+      void hand_over();
+      void write_all();
+   protected:
+      virtual int_type overflow (int_type ch) override;
+      virtual streamsize xsputn (const char* chars,
+                                 streamsize count) override;
+      virtual int sync() override;
+   public:
+      explicit output_pipe (int fd_);
+      output_pipe (const output_pipe&) = delete;
+      output_pipe& operator= (const output_pipe&) = delete;
+      virtual ~output_pipe() override;
+      void close();
+};
+
+#endif
+
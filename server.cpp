@@ -0,0 +1,283 @@
+// $Id: server.cpp,v 1.1 2026-10-18 10:00:00-07 - - $
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "journal.h"
+#include "server.h"
+#include "stats.h"
+#include "util.h"
+
+server_error::server_error (const string& what): runtime_error (what) {
+}
+
+command_guard::command_guard (inode_state& state,
+                              const wordviews& words):
+               fs (state.getFileSystem()) {
+   if (not fs.concurrent()) return;
+   shared = shared_lock<shared_mutex> (fs.tree_lock());
+   reading.emplace();
+   // Followed first, since runs_shared may look from the cwd.
+   state.follow_changes();
+   if (fs.getTable().shared_dirs() == 0 and runs_shared (state, words)) {
+      return;
+   }
+   reading.reset();
+   shared.unlock();
+   exclusive = unique_lock<shared_mutex> (fs.tree_lock());
+   fs.hold_exclusive (true);
+   fs.changed();
+   fs.epochs().collect();
+   state.follow_changes();
+}
+
+command_guard::~command_guard() {
+   if (exclusive) fs.hold_exclusive (false);
+   if (not reading) return;
+   reading.reset();
+   fs.epochs().collect();
+}
+
+namespace {
+
+// socket_buffer -
+//    A streambuf writing to a socket a buffer at a time.  Once the
+//    client has gone, what is written is dropped, and the session
+//    ends at its next read.
+
+class socket_buffer: public streambuf {
+   private:
+      int fd;
+      char buffer[1 << 14];
+      bool failed {false};
+      void drain() {
+         const char* chars = pbase();
+         size_t left = pptr() - pbase();
+         while (left > 0 and not failed) {
+            // Not a signal, if the client has gone.
+            ssize_t count = send (fd, chars, left, MSG_NOSIGNAL);
+            if (count < 0) {
+               if (errno != EINTR) failed = true;
+               continue;
+            }
+            chars += count;
+            left -= count;
+         }
+         setp (buffer, buffer + sizeof buffer);
+      }
+   protected:
+      virtual int_type overflow (int_type ch) override {
+         drain();
+         if (ch != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type (ch);
+            pbump (1);
+         }
+         return traits_type::not_eof (ch);
+      }
+      virtual int sync() override {
+         drain();
+         return failed ? -1 : 0;
+      }
+   public:
+      explicit socket_buffer (int fd_): fd (fd_) {
+         setp (buffer, buffer + sizeof buffer);
+      }
+};
+
+// line_reader -
+//    Reads lines from a socket through a buffer, so a client may send
+//    many at once.  As with getline at end of file, a last line
+//    without a newline is not returned.
+// waiting -
+//    Whether the next line must be waited for, no whole line being
+//    in the buffer.
+
+class line_reader {
+   private:
+      int fd;
+      string buffer;
+      size_t start {0};
+   public:
+      explicit line_reader (int fd_): fd (fd_) {}
+      bool waiting() const {
+         return buffer.find ('\n', start) == string::npos;
+      }
+      bool read_line (string& line) {
+         for (;;) {
+            size_t newline = buffer.find ('\n', start);
+            if (newline != string::npos) {
+               line.assign (buffer, start, newline - start);
+               start = newline + 1;
+               return true;
+            }
+            buffer.erase (0, start);
+            start = 0;
+            char chunk[1 << 14];
+            ssize_t count = read (fd, chunk, sizeof chunk);
+            if (count < 0 and errno == EINTR) continue;
+            if (count <= 0) return false;
+            buffer.append (chunk, count);
+         }
+      }
+};
+
+}
+
+session_server::session_server (file_system& fs_,
+                                const string& path_):
+                fs (fs_), path (path_) {
+   sockaddr_un address {};
+   address.sun_family = AF_UNIX;
+   if (path.size() >= sizeof address.sun_path) {
+      throw server_error (path + ": socket name too long");
+   }
+   path.copy (address.sun_path, path.size());
+   auto named = reinterpret_cast<const sockaddr*> (&address);
+   listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (listener < 0) {
+      throw server_error (path + ": " + strerror (errno));
+   }
+   // A socket nobody answers on was left by a server which did not
+   // stop, and is replaced.  One somebody answers on is in use.
+   struct stat status;
+   if (lstat (path.c_str(), &status) == 0
+       and S_ISSOCK (status.st_mode)) {
+      int probe = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      bool answered = probe >= 0
+                      and connect (probe, named, sizeof address) == 0;
+      if (probe >= 0) close (probe);
+      if (answered) {
+         close (listener);
+         throw server_error (path + ": already being served");
+      }
+      unlink (path.c_str());
+   }
+   if (bind (listener, named, sizeof address) < 0
+       or listen (listener, SOMAXCONN) < 0) {
+      string error = strerror (errno);
+      close (listener);
+      throw server_error (path + ": " + error);
+   }
+   fs.set_concurrent (true);
+   acceptor = thread (&session_server::accept_sessions, this);
+}
+
+session_server::~session_server() {
+   stop();
+}
+
+// accept_sessions -
+//    Starts a thread for each connection until the listener is shut
+//    down, joining the threads of sessions which have finished as it
+//    goes, so they do not pile up.
+
+void session_server::accept_sessions() {
+   for (;;) {
+      int fd = accept4 (listener, nullptr, nullptr, SOCK_CLOEXEC);
+      int error = errno;
+      if (fd < 0 and (error == EINTR or error == ECONNABORTED)) {
+         continue;
+      }
+      vector<thread> reaped;
+      {
+         lock_guard<mutex> guard (lock);
+         if (stopping) {
+            if (fd >= 0) close (fd);
+            break;
+         }
+         if (fd < 0) {
+            complain() << path << ": " << strerror (error) << endl;
+            break;
+         }
+         sessions.emplace (fd, thread (&session_server::run_session,
+                                       this, fd));
+         reaped.swap (done);
+      }
+      TRACEF ('v', "session {} started", fd);
+      for (auto& session: reaped) session.join();
+   }
+}
+
+// run_session -
+//    The command loop of one session.  Unlike the shell reading cin,
+//    a session outlives errors of every kind, and skips empty lines.
+
+void session_server::run_session (int fd) {
+   socket_buffer buffer (fd);
+   ostream out (&buffer);
+   out << boolalpha;
+   line_reader reader (fd);
+   inode_state state (fs, out);
+   string line;
+   wordviews words;
+   for (;;) {
+      try {
+         out << state.prompt();
+         // Flushed only when the client must be waited for, so the
+         // answer to a script sent at once goes a buffer at a time,
+         // and only once what it answers is on disk.
+         settle_journal (state, reader.waiting());
+         if (reader.waiting()) out.flush();
+         if (not reader.read_line (line)) {
+            out << "^D\n";
+            break;
+         }
+         out << line << "\n";
+         tokenize (line, " \t", words);
+         if (words.empty()) continue;
+         command_fn fn = find_command_fn (words[0]);
+         command_timer timer (fn, words[0]);
+         command_guard guard (state, words);
+         fn (state, words);
+      }catch (ysh_exit&) {
+         break;
+      }catch (exception& error) {
+         out << exec::execname() << ": " << error.what() << "\n";
+      }
+   }
+   out.flush();
+   TRACEF ('v', "session {} finished", fd);
+   lock_guard<mutex> guard (lock);
+   auto self = sessions.find (fd);
+   done.push_back (move (self->second));
+   sessions.erase (self);
+   close (fd);
+   finished.notify_all();
+}
+
+void session_server::stop() {
+   if (listener < 0) return;
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+      for (const auto& session: sessions) {
+         shutdown (session.first, SHUT_RDWR);
+      }
+   }
+   // Wakes the acceptor.
+   shutdown (listener, SHUT_RDWR);
+   acceptor.join();
+   close (listener);
+   listener = -1;
+   unlink (path.c_str());
+   vector<thread> reaped;
+   {
+      unique_lock<mutex> held (lock);
+      finished.wait (held, [this] {return sessions.empty();});
+      reaped.swap (done);
+   }
+   for (auto& session: reaped) session.join();
+   fs.set_concurrent (false);
+}
+
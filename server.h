@@ -0,0 +1,99 @@
+// $Id: server.h,v 1.1 2026-10-18 10:00:00-07 - - $
+
+// server -
+//    Serves sessions over a Unix domain socket, each with a cwd and
+//    prompt of its own, on the filesystem of the shell which started
+//    it, so many clients can work on one tree at once.
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "file_sys.h"
+
+// server_error -
+//    Thrown when the socket cannot be set up.
+
+class server_error: public runtime_error {
+   public:
+      explicit server_error (const string& what);
+};
+
+// command_guard -
+//    Held around each command of a session while its filesystem is
+//    concurrent, and does nothing otherwise.  A command line for
+//    which runs_shared is true holds the tree lock shared, so such
+//    commands run side by side, reading without locks and locking
+//    the directories they change, and is an epoch reader throughout,
+//    so nothing it might see is freed under it.  Any other command
+//    holds the lock exclusive, as does every command while a
+//    directory clone still shares entries, since reading a clone can
+//    change it, and first frees everything retired, there being no
+//    reader left.  Once the lock is held, the session follows any
+//    changes made by commands run exclusive or removing directories.
+//    A guard run shared frees what it can as it goes.
+
+class command_guard {
+   private:
+      file_system& fs;
+      shared_lock<shared_mutex> shared;
+      unique_lock<shared_mutex> exclusive;
+      optional<epoch_domain::reader> reading;
+   public:
+      command_guard (inode_state& state, const wordviews& words);
+      command_guard (const command_guard&) = delete;
+      command_guard& operator= (const command_guard&) = delete;
+      ~command_guard();
+};
+
+// session_server -
+//    Listens on a Unix domain socket and runs each connection as a
+//    session of its own on a thread of its own, which reads commands
+//    from the socket and writes its transcript back, as yshell does
+//    when cin is not a tty.  The filesystem is made concurrent for as
+//    long as the server runs.  A session ends at end of file or exit,
+//    and the exit status it gives is the shell's, as for any command.
+// ctor -
+//    Binds the socket and starts accepting.  A socket left behind by
+//    a server no longer running is replaced; throws a server_error if
+//    another is listening there or the socket cannot be made.
+// stop -
+//    Stops accepting, ends every session at its next read, waits for
+//    all of them to finish and removes the socket.  Also done by the
+//    dtor.
+
+class session_server {
+   private:
+      file_system& fs;
+      string path;
+      int listener {-1};
+      thread acceptor;
+      mutex lock;
+      condition_variable finished;
+      // The thread of each session by its socket, and those of
+      // sessions which have finished, until they are joined.
+      map<int,thread> sessions;
+      vector<thread> done;
+      bool stopping {false};
+      void accept_sessions();
+      void run_session (int fd);
+   public:
+      session_server (file_system& fs_, const string& path_);
+      session_server (const session_server&) = delete;
+      session_server& operator= (const session_server&) = delete;
+      ~session_server();
+      void stop();
+};
+
+#endif
+
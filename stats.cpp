@@ -0,0 +1,142 @@
+// $Id: stats.cpp,v 1.1 2026-10-18 08:20:00-07 - - $
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+#include "journal.h"
+#include "stats.h"
+
+array<command_stats::record_t,command_stats::SLOTS>
+      command_stats::records;
+mutex command_stats::lock;
+
+// epoch -
+//    Where both clocks stood at startup, so the ticks of the cycle
+//    counter can be converted to nanoseconds by how far each has
+//    moved since.
+
+using stats_clock = chrono::steady_clock;
+
+static const struct {
+   uint64_t ticks;
+   stats_clock::time_point time;
+} epoch {command_stats::now(), stats_clock::now()};
+
+uint64_t command_stats::now() {
+#if defined (__x86_64__) || defined (__i386__)
+   return __rdtsc();
+#else
+   return chrono::duration_cast<chrono::nanoseconds> (
+          stats_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// find -
+//    Returns the record of a command, hashed by the address of its
+//    function and probed linearly, claiming an empty slot for one
+//    not seen before.  Returns nullptr if the table is full.
+
+command_stats::record_t* command_stats::find (command_fn fn,
+                                              string_view name) {
+   size_t hash = reinterpret_cast<uintptr_t> (fn) >> 4;
+   for (size_t probe = 0; probe < SLOTS; ++probe) {
+      record_t& record = records[(hash + probe) % SLOTS];
+      if (record.fn == fn) return &record;
+      if (record.fn == nullptr) {
+         record.fn = fn;
+         record.name = name;
+         return &record;
+      }
+   }
+   return nullptr;
+}
+
+void command_stats::record (command_fn fn, string_view name,
+                            uint64_t start) {
+   uint64_t ticks = now() - start;
+   lock_guard<mutex> guard (lock);
+   record_t* record = find (fn, name);
+   if (record == nullptr) return;
+   ++record->count;
+   record->ticks += ticks;
+   size_t bucket = 63 - __builtin_clzll (ticks | 1);
+   ++record->buckets[bucket];
+}
+
+// duration -
+//    Formats a number of nanoseconds in the largest unit under it.
+
+static string duration (double nanos) {
+   static const char* units[] {"ns", "us", "ms", "s"};
+   size_t unit = 0;
+   while (unit < 3 and nanos >= 1000) {
+      nanos /= 1000;
+      ++unit;
+   }
+   char buffer[32];
+   snprintf (buffer, sizeof buffer, "%.3g %s", nanos, units[unit]);
+   return buffer;
+}
+
+void command_stats::print (ostream& out, inode_state& state) {
+   double nanos = chrono::duration_cast<chrono::nanoseconds> (
+                  stats_clock::now() - epoch.time).count();
+   uint64_t ticks = now() - epoch.ticks;
+   double ns_per_tick = ticks == 0 ? 1 : nanos / ticks;
+   lock_guard<mutex> guard (lock);
+   vector<const record_t*> used;
+   for (const auto& record: records) {
+      if (record.count > 0) used.push_back (&record);
+   }
+   sort (used.begin(), used.end(),
+         [] (const record_t* left, const record_t* right) {
+            return left->name < right->name;
+         });
+   out << "stats: uptime = " << duration (nanos) << endl;
+   for (const record_t* record: used) {
+      // Each percentile is given as the top of its bucket.
+      auto percentile = [&] (uint64_t percent) {
+         uint64_t rank = (record->count * percent + 99) / 100;
+         uint64_t seen = 0;
+         size_t bucket = 0;
+         while ((seen += record->buckets[bucket]) < rank) ++bucket;
+         return duration (ns_per_tick * 2.0 * (uint64_t (1) << bucket));
+      };
+      out << record->name << ": count = " << record->count
+          << ", total = " << duration (ns_per_tick * record->ticks)
+          << ", mean = "
+          << duration (ns_per_tick * record->ticks / record->count)
+          << ", p50 < " << percentile (50)
+          << ", p99 < " << percentile (99) << endl;
+      out << "   histogram:";
+      for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+         if (record->buckets[bucket] == 0) continue;
+         out << " < " << duration (ns_per_tick * 2.0
+                                   * (uint64_t (1) << bucket))
+             << " = " << record->buckets[bucket];
+      }
+      out << endl;
+   }
+   inode_table& table = state.getTable();
+   out << "inodes: live = " << table.live()
+       << ", next = " << table.next_inode_nr()
+       << ", doomed = " << table.doomed_count() << endl;
+   out << "directory entries = " << table.dirent_count() << endl;
+   auto& root = dynamic_cast<directory&> (
+                *state.getRoot()->getContents());
+   out << "file bytes = " << root.bytes()
+       << ", arena bytes = " << state.getArena().in_use() << endl;
+   blob_store& blobs = state.getFileSystem().getBlobs();
+   out << blobs << endl;
+   out << blobs.getIndex() << endl;
+   journal* log = state.getFileSystem().getJournal();
+   if (log != nullptr) log->print (out);
+}
+
@@ -0,0 +1,82 @@
+// $Id: stats.h,v 1.1 2026-10-18 08:20:00-07 - - $
+
+// stats -
+//    Counts and times every command run, so slow commands can be
+//    found without rebuilding or turning on debug flags, and reports
+//    them with gauges of the size of the filesystem.
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+using namespace std;
+
+#include "commands.h"
+#include "file_sys.h"
+
+// command_stats -
+//    Static class holding a record per command function:  its count,
+//    total time, and a histogram of its latencies with a bucket per
+//    power of two clock ticks.  Times are read from the cycle counter
+//    where there is one, and converted to nanoseconds only when
+//    printed, so recording a command costs two counter reads and a
+//    few increments, under a lock since sessions record on threads of
+//    their own.
+// now -
+//    Returns the current time in ticks.
+// record -
+//    Adds one run of the command, which started at the given tick,
+//    the name being copied only the first time the command is seen.
+// print -
+//    Prints a line per command, its histogram, and the gauges of the
+//    filesystem:  live inodes, directory entries, bytes of plain file
+//    data and the next inode number, how many file blocks are shared
+//    and what sharing them saves, the size of the word index, then
+//    those of any journal.
+
+class command_stats {
+   private:
+      static constexpr size_t BUCKETS = 64;
+      static constexpr size_t SLOTS = 128;
+      struct record_t {
+         command_fn fn {nullptr};
+         string name;
+         uint64_t count {0};
+         uint64_t ticks {0};
+         array<uint64_t,BUCKETS> buckets {};
+      };
+      static array<record_t,SLOTS> records;
+      static mutex lock;
+      static record_t* find (command_fn fn, string_view name);
+   public:
+      static uint64_t now();
+      static void record (command_fn fn, string_view name,
+                          uint64_t start);
+      static void print (ostream& out, inode_state& state);
+};
+
+// command_timer -
+//    Records the command in command_stats when it goes out of scope,
+//    whether the command returns or throws.
+
+class command_timer {
+   private:
+      command_fn fn;
+      string_view name;
+      uint64_t start;
+   public:
+      command_timer (command_fn fn_, string_view name_):
+                     fn (fn_), name (name_),
+                     start (command_stats::now()) {}
+      command_timer (const command_timer&) = delete;
+      command_timer& operator= (const command_timer&) = delete;
+      ~command_timer() {command_stats::record (fn, name, start);}
+};
+
+#endif
+
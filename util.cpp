@@ -1,6 +1,11 @@
 // $Id: util.cpp,v 1.14 2019-10-08 14:01:38-07 - - $
 
+#include <atomic>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
 #include <unistd.h>
 
 using namespace std;
@@ -19,7 +24,7 @@ bool want_echo() {
 }
 
 string exec::execname_; // Must be initialized from main().
-int exec::status_ = EXIT_SUCCESS;
+atomic<int> exec::status_ {EXIT_SUCCESS};
 
 string basename (const string &arg) { 
    return arg.substr (arg.find_last_of ('/') + 1);
@@ -33,10 +38,41 @@ void exec::execname (const string& argv0) {
 }
 
 void exec::status (int status) {
-   if (status_ < status) status_ = status;
+   int old = status_.load();
+   // Keeps the largest status, however many threads set one.
+   while (old < status
+          and not status_.compare_exchange_weak (old, status)) {
+   }
 }
 
 
+string read_all (int fd) {
+   constexpr size_t READ_SIZE = 1 << 20;
+   string result;
+   struct stat status;
+   if (fstat (fd, &status) == 0 and S_ISREG (status.st_mode)) {
+      result.reserve (status.st_size);
+   }
+   size_t length = 0;
+   for (;;) {
+      if (result.size() < length + READ_SIZE) {
+         result.resize (max (length + READ_SIZE, result.capacity()));
+      }
+      ssize_t count = read (fd, result.data() + length,
+                            result.size() - length);
+      if (count == 0) break;
+      if (count < 0) {
+         if (errno == EINTR) continue;
+         complain() << "read: " << strerror (errno) << endl;
+         break;
+      }
+      length += count;
+   }
+   result.resize (length);
+   TRACEF ('u', "read {} bytes", length);
+   return result;
+}
+
 wordvec split (const string& line, const string& delimiters) {
    wordvec words;
    size_t end = 0;
@@ -53,6 +89,39 @@ wordvec split (const string& line, const string& delimiters) {
    return words;
 }
 
+void tokenize (string_view line, string_view delimiters,
+               wordviews& words) {
+   words.clear();
+   size_t end = 0;
+   for (;;) {
+      size_t start = line.find_first_not_of (delimiters, end);
+      if (start == string_view::npos) break;
+      end = line.find_first_of (delimiters, start);
+      if (end == string_view::npos) end = line.size();
+      words.push_back (line.substr (start, end - start));
+   }
+   DEBUGF ('u', words);
+}
+
+void run_parallel (size_t count, const function<void(size_t)>& task) {
+   size_t threads = min<size_t> (thread::hardware_concurrency(), count);
+   TRACEF ('u', "tasks = {}, threads = {}", count, threads);
+   atomic<size_t> next {0};
+   auto worker = [&] {
+      for (;;) {
+         size_t index = next.fetch_add (1, memory_order_relaxed);
+         if (index >= count) break;
+         task (index);
+      }
+   };
+   vector<thread> pool;
+   for (size_t helper = 1; helper < threads; ++helper) {
+      pool.emplace_back (worker);
+   }
+   worker();
+   for (auto& helper: pool) helper.join();
+}
+
 ostream& complain() {
    exec::status (EXIT_FAILURE);
    cerr << exec::execname() << ": ";
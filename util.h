@@ -7,9 +7,13 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 using namespace std;
 
@@ -20,6 +24,8 @@ using range_type = pair<iterator,iterator>;
 
 using wordvec = vector<string>;
 using word_range = range_type<decltype(declval<wordvec>().cbegin())>;
+using wordviews = vector<string_view>;
+using wordview_range = range_type<wordviews::const_iterator>;
 
 // want_echo -
 //    We want to echo all of cin to cout if either cin or cout
@@ -39,7 +45,8 @@ bool want_echo();
 class exec {
    private:
       static string execname_;
-      static int status_;
+      // Set by sessions on other threads as well as by main.
+      static atomic<int> status_;
       static void execname (const string& argv0);
       friend int main (int, char**);
    public:
@@ -49,6 +56,13 @@ class exec {
 };
 
 
+// read_all -
+//    Reads everything remaining on a file descriptor into one string
+//    with a few large reads, sized up front when fstat knows the size
+//    of the file.  Used to slurp a whole script in batch mode.
+
+string read_all (int fd);
+
 // split -
 //    Split a string into a wordvec (as defined above).  Any sequence
 //    of chars in the delimiter string is used as a separator.  To
@@ -56,6 +70,36 @@ class exec {
 
 wordvec split (const string& line, const string& delimiter);
 
+// tokenize -
+//    As split, but fills words with views into the line instead of
+//    copying each word, replacing what words held before.  Reusing
+//    the same wordviews for every line, nothing is allocated once it
+//    has grown to the longest line.  The views are valid as long as
+//    the line is unchanged.
+
+void tokenize (string_view line, string_view delimiters,
+               wordviews& words);
+
+// run_parallel -
+//    Calls task (index) for every index below count, spread over as
+//    many threads as there are cores, at most one per task.  Threads
+//    claim the next unclaimed index as they finish one, so tasks of
+//    uneven size still balance.  Returns when all are done.  Tasks
+//    must not write to anything another task reads.
+
+void run_parallel (size_t count, const function<void(size_t)>& task);
+
+// lock_if -
+//    Returns a lock holding the mutex if wanted, or otherwise holding
+//    nothing, for what needs locking only while several threads share
+//    it.  Left unwanted, a lock costs a test and a branch.
+
+template <typename mutex_t>
+unique_lock<mutex_t> lock_if (mutex_t& lock, bool wanted) {
+   if (wanted) return unique_lock<mutex_t> (lock);
+   return unique_lock<mutex_t> (lock, defer_lock);
+}
+
 // complain -
 //    Used for starting error messages.  Sets the exit status to
 //    EXIT_FAILURE, writes the program name to cerr, and then